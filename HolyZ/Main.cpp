@@ -37,7 +37,14 @@
 #include "strops.h"
 #include "builtin.h"
 #include "main.h"
+#include "optimizer.h"
 #include "anyops.h"
+#include "typeinfer.h"
+#include "condition.h"
+#include "script_cache.h"
+#include "module_loader.h"
+#include "jit.h"
+#include "transpiler.h"
 
 #include "ZS.h"
 
@@ -52,6 +59,41 @@ inline bool IsKeyword(const string& token, const string& keyword) {
 unordered_map<string, boost::any> globalVariableValues;
 unordered_map<string, vector<vector<string>>> functionValues;
 
+// Script functions that only pass their parameters on to a ZS native. Calls to
+// them go straight to the native instead of running the function body
+struct NativeBinding
+{
+	string nativeName;
+	size_t paramCount;
+	bool returnsValue;
+	// Type of the "<type> out" the wrapper returns, converted to like the
+	// declaration would
+	StaticType returnType;
+};
+unordered_map<string, NativeBinding> nativeBindings;
+
+// Hot while loops, keyed by the text of the loop. Used with --jit
+bool jitEnabled = false;
+const int jitHotLoopThreshold = 50;
+struct JitLoopState
+{
+	int iterations = 0;
+	bool tried = false;
+	unique_ptr<Jit::CompiledLoop> loop;
+};
+unordered_map<string, JitLoopState> jitLoops;
+
+// Script functions compiled to native code with --emit-cpp
+bool emitCpp = false;
+struct CompiledFunction
+{
+	Transpiler::EntryPoint entry;
+	size_t paramCount;
+	bool returnsValue;
+	StaticType returnType;
+};
+unordered_map<string, CompiledFunction> compiledFunctions;
+
 // Memory heap for dynamic allocation
 MemoryHeap globalMemoryHeap;
 
@@ -71,6 +113,10 @@ boost::any GetVariableValue(const string& varName, const unordered_map<string, b
 	string classSubComponent;
 	string baseName = trim(varName);
 
+	// A number literal like 0.5, whose '.' isn't a member access
+	if (!baseName.empty() && isdigit(baseName[0]) && isNumber(baseName))
+		return baseName;
+
 	if (count(varName, '.') > 0)
 	{
 		classSubComponent = trim(varName.substr(indexInStr(varName, '.') + 1, -1));
@@ -85,7 +131,7 @@ boost::any GetVariableValue(const string& varName, const unordered_map<string, b
 			if (classSubComponent.empty())
 				return *currentThisContext;
 			else
-				return GetClassAttribute(*currentThisContext, classSubComponent);
+				return GetClassAttribute(attributeSites[varName], *currentThisContext, classSubComponent);
 		}
 	}
 
@@ -97,11 +143,17 @@ boost::any GetVariableValue(const string& varName, const unordered_map<string, b
 		outputValue = iA->second;
 	else if (iB != globalVariableValues.end())
 		outputValue = iB->second;
+	else if (!classSubComponent.empty() && globalClassDefinitions.find(baseName) != globalClassDefinitions.end())
+		return GetStaticAttribute(attributeSites[varName], baseName, classSubComponent);
 	else
 		outputValue = varName;
 
 	if (count(varName, '.') > 0 && !outputValue.empty())
+	{
+		if (const ClassInstance* instance = boost::any_cast<ClassInstance>(&outputValue))
+			return GetClassAttribute(attributeSites[varName], *instance, classSubComponent);
 		return GetClassSubComponent(outputValue, classSubComponent);
+	}
 	else
 		return outputValue;
 }
@@ -210,6 +262,17 @@ bool IsHolyCFunction(const string& funcName)
 	return false;
 }
 
+// Parsed form of a call expression, cached by its text so evaluating the same
+// call again skips resolving and splitting its name and arguments
+struct CallSite
+{
+	enum Kind { ScriptFunction, HolyCFunction, ZSNative };
+	Kind kind;
+	string name;
+	vector<string> argList;
+};
+unordered_map<string, CallSite> callSites;
+
 // Forward declarations
 boost::any ExecuteHolyCFunction(const string& functionName, const vector<boost::any>& args);
 boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unordered_map<string, boost::any>& variableValues);
@@ -220,6 +283,30 @@ boost::any EvalExpression(const string& ex, unordered_map<string, boost::any>& v
 	string expression = trim(ex);
 	bool inQuotes = false;
 
+	// Constant folded by the optimizer
+	if (startsWith(expression, "#const"))
+		return foldedConstants.at(stoi(expression.substr(6)));
+	// Arithmetic specialized by the type inference pass
+	if (startsWith(expression, "#typed"))
+		return EvaluateTypedExpression(stoi(expression.substr(6)), variableValues);
+	// A lone local or whole number, like the right side of "i += 1"
+	auto local = variableValues.find(expression);
+	if (local != variableValues.end())
+		return local->second;
+	if (IsIntegerText(expression) && expression[0] != '-')
+		return expression;
+
+	auto site = callSites.find(expression);
+	if (site != callSites.end())
+	{
+		vector<boost::any> funcArgs = VarValues(site->second.argList, variableValues);
+		if (site->second.kind == CallSite::ScriptFunction)
+			return ExecuteFunction(site->second.name, funcArgs);
+		else if (site->second.kind == CallSite::HolyCFunction)
+			return ExecuteHolyCFunction(site->second.name, funcArgs);
+		return ZSFunction(site->second.name, funcArgs);
+	}
+
 #if DEVELOPER_MESSAGES == true
 	//InterpreterLog("	old expression: |" + expression + "|");
 #endif
@@ -240,6 +327,7 @@ boost::any EvalExpression(const string& ex, unordered_map<string, boost::any>& v
 			cout << split(expression, '(')[0] << "  [" << unWrapVec(argList) << "]" << endl;
 			printVarValues(argList, variableValues);
 #endif
+			callSites[expression] = { CallSite::ScriptFunction, split(expression, '(')[0], argList };
 			vector<boost::any> funcArgs = VarValues(argList, variableValues);
 			return ExecuteFunction(split(expression, '(')[0], funcArgs);
 		}
@@ -250,6 +338,7 @@ boost::any EvalExpression(const string& ex, unordered_map<string, boost::any>& v
 #if DEVELOPER_MESSAGES == true
 			cout << split(expression, '(')[0] << "  [" << unWrapVec(argList) << "]" << endl;
 #endif
+			callSites[expression] = { CallSite::HolyCFunction, split(expression, '(')[0], argList };
 			vector<boost::any> funcArgs = VarValues(argList, variableValues);
 			return ExecuteHolyCFunction(split(expression, '(')[0], funcArgs);
 		}
@@ -263,6 +352,7 @@ boost::any EvalExpression(const string& ex, unordered_map<string, boost::any>& v
 			cout << split(expression, '(')[0] << "  [" << unWrapVec(argList) << "]" << endl;
 			printVarValues(argList, variableValues);
 #endif
+			callSites[expression] = { CallSite::ZSNative, split(expression, '(')[0], argList };
 			vector<boost::any> funcArgs = VarValues(argList, variableValues);
 			return ZSFunction(split(expression, '(')[0], funcArgs);
 		}
@@ -399,26 +489,89 @@ bool BooleanLogic(const string& valA, const string& comparer, const string& valB
 	return false;
 }
 
+// Applies "x op= operand" to a number in place. The target decides the type
+// of the result, for all four operators: a target that reads as an int (an
+// int, or the text of a whole number like a literal argument) stays an int,
+// and any other target becomes a float. Between two ints, + - * wrap around
+// on overflow and / keeps the whole part. With a float operand, or a zero
+// divisor, the result is computed as a float and converted like an int
+// declaration: truncated, saturated to the int range, and NaN becomes 0.
+// Returns false if either side isn't a number
+bool ApplyNumericAssignment(boost::any& slot, char op, const boost::any& operand)
+{
+	if (!IsNumericValue(slot) || !IsNumericValue(operand))
+		return false;
+
+	bool intTarget = StaticTypeOfValue(slot) == StaticType::Int;
+	if (intTarget && StaticTypeOfValue(operand) == StaticType::Int)
+	{
+		int a = slot.type() == typeid(int) ? any_cast<int>(slot) : stoi(any_cast<const string&>(slot));
+		int b = operand.type() == typeid(int) ? any_cast<int>(operand) : stoi(any_cast<const string&>(operand));
+		// Wraps around on overflow instead of being undefined
+		if (op == '+')
+		{
+			slot = (int)((unsigned)a + (unsigned)b);
+			return true;
+		}
+		if (op == '-')
+		{
+			slot = (int)((unsigned)a - (unsigned)b);
+			return true;
+		}
+		if (op == '*')
+		{
+			slot = (int)((unsigned)a * (unsigned)b);
+			return true;
+		}
+		if (b != 0 && !(a == INT_MIN && b == -1))
+		{
+			slot = a / b;
+			return true;
+		}
+	}
+
+	float x = AnyAsFloat(slot), y = AnyAsFloat(operand);
+	float result = op == '+' ? x + y : op == '-' ? x - y : op == '*' ? x * y : x / y;
+	slot = intTarget ? ToDeclaredType(StaticType::Int, boost::any(result)) : boost::any(result);
+	return true;
+}
+
+// Assigns to a variable holding an int, float, bool or string
+void AssignSimpleValue(boost::any& slot, const vector<string>& str, unordered_map<string, boost::any>& variableValues)
+{
+	const string& op = str.at(1);
+	string operandText = unWrapVec(vector<string>(str.begin() + 2, str.end()));
+	if (op == "=")
+		slot = EvalExpression(operandText, variableValues);
+	else if (op != "+=" && op != "-=" && op != "*=" && op != "/=")
+		LogWarning("unrecognized operator \'" + op + "\'");
+	// Strings are joined by the expression evaluator, which reads the whole
+	// "x+(operand)" as one expression
+	else if (op == "+=" && !IsNumericValue(slot))
+		slot = EvalExpression(str.at(0) + "+(" + operandText + ")", variableValues);
+	else
+	{
+		boost::any operand = EvalExpression(operandText, variableValues);
+		if (ApplyNumericAssignment(slot, op[0], operand))
+			return;
+		if (op == "+=")
+			slot = EvalExpression(str.at(0) + "+(" + operandText + ")", variableValues);
+		else if (op == "-=")
+			slot = AnyAsFloat(slot) - AnyAsFloat(operand);
+		else if (op == "*=")
+			slot = AnyAsFloat(slot) * AnyAsFloat(operand);
+		else
+			slot = AnyAsFloat(slot) / AnyAsFloat(operand);
+	}
+}
+
 int varOperation(const vector<string>& str, unordered_map<string, boost::any>& variableValues)
 {
 	if (IsVar(str.at(0), variableValues))
 	{
 		// Checks if type is simple, like int or string
 		if (any_type(variableValues[str.at(0)]) <= 3)
-		{
-			if (str.at(1) == "=")
-				variableValues[str.at(0)] = EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues);
-			else if (str.at(1) == "+=")
-				variableValues[str.at(0)] = EvalExpression(str.at(0) + "+(" + unWrapVec(vector<string>(str.begin() + 2, str.end())) + ")", variableValues);
-			else if (str.at(1) == "-=")
-				variableValues[str.at(0)] = AnyAsFloat(variableValues[str.at(0)]) - AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else if (str.at(1) == "*=")
-				variableValues[str.at(0)] = AnyAsFloat(variableValues[str.at(0)]) * AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else if (str.at(1) == "/=")
-				variableValues[str.at(0)] = AnyAsFloat(variableValues[str.at(0)]) / AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else
-				LogWarning("unrecognized operator \'" + str.at(1) + "\'");
-		}
+			AssignSimpleValue(variableValues[str.at(0)], str, variableValues);
 #ifdef HOLYZ_GRAPHICS_ENABLED
 		// Else it is a Vec2. No other complex class can be operated on it's base form (ex. you can't do: Sprite += Sprite)
 		else if (any_type(variableValues[str.at(0)]) == 5)
@@ -444,20 +597,7 @@ int varOperation(const vector<string>& str, unordered_map<string, boost::any>& v
 	{
 		// Checks if type is simple, like int or string
 		if (any_type(globalVariableValues[str.at(0)]) <= 3)
-		{
-			if (str.at(1) == "=")
-				globalVariableValues[str.at(0)] = EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues);
-			else if (str.at(1) == "+=")
-				globalVariableValues[str.at(0)] = EvalExpression(str.at(0) + "+(" + unWrapVec(vector<string>(str.begin() + 2, str.end())) + ")", variableValues);
-			else if (str.at(1) == "-=")
-				globalVariableValues[str.at(0)] = AnyAsFloat(globalVariableValues[str.at(0)]) - AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else if (str.at(1) == "*=")
-				globalVariableValues[str.at(0)] = AnyAsFloat(globalVariableValues[str.at(0)]) * AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else if (str.at(1) == "/=")
-				globalVariableValues[str.at(0)] = AnyAsFloat(globalVariableValues[str.at(0)]) / AnyAsFloat(EvalExpression(unWrapVec(vector<string>(str.begin() + 2, str.end())), variableValues));
-			else
-				LogWarning("unrecognized operator \'" + str.at(1) + "\'");
-		}
+			AssignSimpleValue(globalVariableValues[str.at(0)], str, variableValues);
 #ifdef HOLYZ_GRAPHICS_ENABLED
 		// Else it is a Vec2. No other complex class can be operated on it's base form (ex. you can't do: Sprite += Sprite)
 		else if (any_type(globalVariableValues[str.at(0)]) == 5)
@@ -824,12 +964,116 @@ boost::any ExecuteHolyCFunction(const string& functionName, const vector<boost::
 	}
 }
 
+// Moves lineNum from an else line to the last line of its block. An
+// "else if" takes the blocks of the elses that follow it along
+void SkipElseChain(const vector<vector<string>>& words, int& lineNum)
+{
+	while (lineNum < (int)words.size())
+	{
+		bool elseIf = words.at(lineNum).size() > 1 && IsKeyword(words.at(lineNum).at(1), "if");
+		int numOfBrackets = 0;
+		for (const string& word : words.at(lineNum))
+			if (count(word, '{') != 0)
+			{
+				numOfBrackets = 1;
+				break;
+			}
+
+		lineNum++;
+		while (lineNum < (int)words.size())
+		{
+			numOfBrackets += countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
+			if (numOfBrackets == 0)
+				break;
+			lineNum++;
+		}
+		if (!elseIf || lineNum + 1 >= (int)words.size() || !IsKeyword(words.at(lineNum + 1).at(0), "else"))
+			return;
+		lineNum++;
+	}
+}
+
+// Counts the iterations of a hot loop and compiles it once it reaches the
+// threshold. When a compiled version exists and every variable it uses holds
+// an int, runs the rest of the loop natively and returns true
+bool RunCompiledLoop(JitLoopState& state, const vector<string>& condition, const vector<vector<string>>& body, unordered_map<string, boost::any>& variableValues)
+{
+	// The text of a whole number reads as an int, but only an int stays one
+	// when assigned to
+	auto holdsInt = [&](const string& name)
+	{
+		auto local = variableValues.find(name);
+		const boost::any* value = local != variableValues.end() ? &local->second : nullptr;
+		if (value == nullptr && globalVariableValues.find(name) != globalVariableValues.end())
+			value = &globalVariableValues[name];
+		return value != nullptr && (value->type() == typeid(int) || (value->type() == typeid(string) && IsIntegerText(any_cast<const string&>(*value))));
+	};
+
+	if (!state.tried && ++state.iterations >= jitHotLoopThreshold)
+	{
+		state.tried = true;
+		// Only "a comparer b", possibly followed by the empty word left by '{'
+		if (condition.size() == 3 || (condition.size() == 4 && condition.at(3).empty()))
+		{
+			vector<vector<string>> plainBody;
+			for (const vector<string>& line : body)
+				plainBody.push_back(ExpandTypedWords(line));
+			state.loop = Jit::compileLoop(ExpandTypedWords(vector<string>(condition.begin(), condition.begin() + 3)), plainBody, types, holdsInt);
+		}
+#if DEVELOPER_MESSAGES == true
+		InterpreterLog((state.loop ? "JIT compiled loop: while " : "JIT can't compile loop: while ") + unWrapVec(condition));
+#endif
+	}
+	if (!state.loop)
+		return false;
+
+	// Guard: the variables must exist and hold ints
+	const vector<string>& names = state.loop->variables();
+	vector<unordered_map<string, boost::any>*> owners(names.size());
+	vector<Jit::Value> values(names.size());
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		if (variableValues.find(names[i]) != variableValues.end())
+			owners[i] = &variableValues;
+		else if (globalVariableValues.find(names[i]) != globalVariableValues.end())
+			owners[i] = &globalVariableValues;
+		else
+			return false;
+
+		const boost::any& value = (*owners[i])[names[i]];
+		if (!holdsInt(names[i]))
+			return false;
+		if (state.loop->isAssigned(i) && value.type() == typeid(string))
+			return false;
+		values[i].integer = value.type() == typeid(int) ? any_cast<int>(value) : stoi(any_cast<const string&>(value));
+	}
+
+	state.loop->run(values);
+	for (size_t i = 0; i < names.size(); i++)
+		if (state.loop->isAssigned(i))
+			(*owners[i])[names[i]] = values[i].integer;
+	return true;
+}
+
 boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unordered_map<string, boost::any>& variableValues)
 {
 	//// Check if the first two chars are '//', which would make it a comment
 	//if (startsWith(words.at(lineNum).at(0), "//"))
 	//	return nullType;
 
+	// Compound assignment to a local, the statement loops run the most, goes
+	// straight to the variable
+	const vector<string>& line = words.at(lineNum);
+	if (line.size() >= 3 && line.at(1).size() == 2 && line.at(1)[1] == '=' && (line.at(1)[0] == '+' || line.at(1)[0] == '-' || line.at(1)[0] == '*' || line.at(1)[0] == '/'))
+	{
+		auto local = variableValues.find(line.at(0));
+		if (local != variableValues.end() && any_type(local->second) >= 0 && any_type(local->second) <= 3)
+		{
+			AssignSimpleValue(local->second, line, variableValues);
+			return nullType;
+		}
+	}
+
 	// If print statement (deprecated, now use ZS.System.Print() function)
 	if (IsKeyword(words.at(lineNum).at(0), "print"))
 	{
@@ -859,8 +1103,12 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 		return EvalExpression(unWrapVec(vector<string>(words.at(lineNum).begin() + 1, words.at(lineNum).end())), variableValues);
 
 	// Check if it is ZS Builtin function call
+	// A native called as a statement, its result is dropped like a function's
 	else if (startsWith(words.at(lineNum).at(0), "ZS."))
-		return EvalExpression(unWrapVec(words.at(lineNum)), variableValues);
+	{
+		EvalExpression(unWrapVec(words.at(lineNum)), variableValues);
+		return nullType;
+	}
 
 	// Check if it is function call
 	else if (IsFunction(split(words.at(lineNum).at(0), '(')[0]))
@@ -899,7 +1147,7 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 	{
 		try
 		{
-			globalVariableValues[words.at(lineNum).at(2)] = EvalExpression(unWrapVec(slice(words.at(lineNum), 4, -1)), variableValues);
+			globalVariableValues[words.at(lineNum).at(2)] = ToDeclaredType(StaticTypeOf(words.at(lineNum).at(1)), EvalExpression(unWrapVec(slice(words.at(lineNum), 4, -1)), variableValues));
 		}
 		catch (const std::exception&)
 		{
@@ -914,7 +1162,7 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 	{
 		try
 		{
-			variableValues[words.at(lineNum).at(1)] = EvalExpression(unWrapVec(slice(words.at(lineNum), 3, -1)), variableValues);
+			variableValues[words.at(lineNum).at(1)] = ToDeclaredType(StaticTypeOf(words.at(lineNum).at(0)), EvalExpression(unWrapVec(slice(words.at(lineNum), 3, -1)), variableValues));
 		}
 		catch (const std::exception&)
 		{
@@ -961,8 +1209,10 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 			}
 		}
 
+		const CompiledCondition& whileCondition = GetCondition(whileParameters);
+
 		// If the statement is already false, don't bother gathering the contents
-		if (BooleanLogic(whileParameters.at(0), whileParameters.at(1), whileParameters.at(2), variableValues) == false) {
+		if (whileCondition.evaluate(variableValues) == false) {
 			lineNum++;
 			while (lineNum < (int)words.size())
 			{
@@ -987,9 +1237,21 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 
 		//whileContents = removeTabsWdArry(whileContents, 1);
 
+		JitLoopState* jitLoop = nullptr;
+		if (jitEnabled)
+		{
+			string key = unWrapVec(whileParameters);
+			for (const vector<string>& line : whileContents)
+				key += "\n" + unWrapVec(line);
+			jitLoop = &jitLoops[key];
+		}
+
 		// Loop while true
-		while (BooleanLogic(whileParameters.at(0), whileParameters.at(1), whileParameters.at(2), variableValues))
+		while (whileCondition.evaluate(variableValues))
 		{
+			if (jitLoop != nullptr && RunCompiledLoop(*jitLoop, whileParameters, whileContents, variableValues))
+				return nullType;
+
 			//Iterate through all lines in while loop
 			for (int lineNum = 0; lineNum < (int)whileContents.size(); lineNum++)
 			{
@@ -1033,34 +1295,30 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 			}
 		}
 
-		// If the statement is already false, don't bother gathering the contents
-		if (BooleanLogic(ifParameters.at(0), ifParameters.at(1), ifParameters.at(2), variableValues) == false) {
-			lineNum++;
-			while (lineNum < (int)words.size())
-			{
-				numOfBrackets += countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
-				if (numOfBrackets == 0)
-					break;
-				lineNum++;
-			}
-			return nullType;
-		}
+		// Evaluated once, the contents are only gathered if it is true
+		bool isTrue = GetCondition(ifParameters).evaluate(variableValues);
 
-		// Gather the contents
 		lineNum++;
 		while (lineNum < (int)words.size())
 		{
 			numOfBrackets += countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
 			if (numOfBrackets == 0)
 				break;
-			ifContents.push_back(words.at(lineNum));
+			if (isTrue)
+				ifContents.push_back(words.at(lineNum));
 			lineNum++;
 		}
 		//ifContents = removeTabsWdArry(ifContents, 1);
 
-		// Execute if true
-		if (BooleanLogic(ifParameters.at(0), ifParameters.at(1), ifParameters.at(2), variableValues))
+		// Execute if true, and step over an else that follows
+		if (isTrue)
 		{
+			if (lineNum + 1 < (int)words.size() && IsKeyword(words.at(lineNum + 1).at(0), "else"))
+			{
+				int elseLine = lineNum + 1;
+				SkipElseChain(words, elseLine);
+				lineNum = elseLine;
+			}
 			//Iterate through all lines in if statement
 			for (int l = 0; l < (int)ifContents.size(); l++)
 			{
@@ -1071,42 +1329,54 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 					return returnVal;
 			}
 		}
-		else if (words.size() > lineNum)
+		else if (lineNum + 1 < (int)words.size() && IsKeyword(words.at(lineNum + 1).at(0), "else"))
 		{
-			if (IsKeyword(words[lineNum].at(0), "else"))
+			lineNum++;
+
+			// "else if" runs as an if statement of its own, with its own else
+			if (words.at(lineNum).size() > 1 && IsKeyword(words.at(lineNum).at(1), "if"))
 			{
-				vector<vector<string>> elseContents;
-				vector<string> elseParameters;
+				int chainEnd = lineNum;
+				SkipElseChain(words, chainEnd);
+				vector<vector<string>> chain(words.begin() + lineNum, words.begin() + min(chainEnd + 1, (int)words.size()));
+				chain.at(0).erase(chain.at(0).begin());
+				int chainLine = 0;
+				boost::any returnVal = ProcessLine(chain, chainLine, variableValues);
+				lineNum = chainEnd;
+				return returnVal;
+			}
 
-				int numOfBrackets = 0;
-				for (int w = 1; w < (int)words.at(lineNum).size(); w++) {
-					if (count(words.at(lineNum).at(w), '{') != 0)
-					{
-						numOfBrackets = 1;
-						break;
-					}
-				}
+			vector<vector<string>> elseContents;
 
-				lineNum++;
-				while (lineNum < (int)words.size())
+			int numOfBrackets = 0;
+			for (int w = 1; w < (int)words.at(lineNum).size(); w++) {
+				if (count(words.at(lineNum).at(w), '{') != 0)
 				{
-					numOfBrackets += countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
-					if (numOfBrackets == 0)
-						break;
-					elseContents.push_back(words.at(lineNum));
-					lineNum++;
+					numOfBrackets = 1;
+					break;
 				}
+			}
 
-				//elseContents = removeTabsWdArry(elseContents, 1);
+			lineNum++;
+			while (lineNum < (int)words.size())
+			{
+				numOfBrackets += countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
+				if (numOfBrackets == 0)
+					break;
+				elseContents.push_back(words.at(lineNum));
+				lineNum++;
+			}
 
-				//Iterate through all lines in else statement
-				for (int l = 0; l < (int)elseContents.size(); l++)
-				{
-					boost::any returnVal = ProcessLine(elseContents, l, variableValues);
-					if (!returnVal.empty())
-						return returnVal;
-				}
+			//elseContents = removeTabsWdArry(elseContents, 1);
 
+			//Iterate through all lines in else statement
+			for (int l = 0; l < (int)elseContents.size(); l++)
+			{
+				if (elseContents.at(l).at(0) == "break")
+					return breakReOp;
+				boost::any returnVal = ProcessLine(elseContents, l, variableValues);
+				if (!returnVal.empty())
+					return returnVal;
 			}
 		}
 		return nullType;
@@ -1116,8 +1386,35 @@ boost::any ProcessLine(const vector<vector<string>>& words, int& lineNum, unorde
 
 boost::any ExecuteFunction(const string& functionName, const vector<boost::any>& inputVarVals)
 {
+	// Wrappers around a native skip the interpreted call entirely
+	auto binding = nativeBindings.find(functionName);
+	if (binding != nativeBindings.end() && inputVarVals.size() >= binding->second.paramCount)
+	{
+		boost::any result;
+		if (inputVarVals.size() == binding->second.paramCount)
+			result = ZSFunction(binding->second.nativeName, inputVarVals);
+		else
+			result = ZSFunction(binding->second.nativeName, vector<boost::any>(inputVarVals.begin(), inputVarVals.begin() + binding->second.paramCount));
+		return binding->second.returnsValue ? ToDeclaredType(binding->second.returnType, result) : nullType;
+	}
+
+	// Functions compiled with --emit-cpp run natively when every argument is a
+	// number, and interpreted otherwise
+	auto compiled = compiledFunctions.find(functionName);
+	if (compiled != compiledFunctions.end() && inputVarVals.size() == compiled->second.paramCount
+		&& all_of(inputVarVals.begin(), inputVarVals.end(), IsNumericValue))
+	{
+		vector<double> args;
+		for (const boost::any& value : inputVarVals)
+			args.push_back(AnyAsFloat(value));
+		double result = compiled->second.entry(args.data());
+		return compiled->second.returnsValue ? ToDeclaredType(compiled->second.returnType, boost::any((float)result)) : nullType;
+	}
+
 	// Get contents of function from global function map
-	std::vector<std::vector<std::string>> words = functionValues[functionName];
+	std::vector<std::vector<std::string>>& words = functionValues[functionName];
+	if (OptimizeFunction(functionName, words))
+		TypeFunction(functionName, words);
 
 	unordered_map<string, boost::any> variableValues = {};
 
@@ -1214,18 +1511,31 @@ void RunREPL()
 	}
 }
 
-int parseHolyZ(string script)
+// Splits the script into lines of words, which is the form the interpreter
+// runs on. Comments and blank lines are dropped
+vector<vector<string>> TokenizeScript(string_view script)
 {
 	//script = replace(script, "    ", "\t"); // Replace spaces with tabs (not really required, and will break purposefull whitespace in strings etc.)
 
-	// Split the script by newline, signifying a line ending
-	vector<string> beforeProcessLines = split(script, '\n');
+	// Split the script by newline, signifying a line ending. The script is
+	// walked in place, so only the lines that are kept get copied
 	vector<string> lines;
-	for (int i = 0; i < (int)beforeProcessLines.size(); i++) { // Then split said lines into indiviual words
-		if (!startsWith(trim(beforeProcessLines.at(i)), "//") && trim(beforeProcessLines.at(i)) != "")
+	size_t lineStart = 0;
+	while (lineStart < script.size())
+	{
+		size_t lineEnd = script.find('\n', lineStart);
+		if (lineEnd == string_view::npos)
+			lineEnd = script.size();
+		size_t lineLength = lineEnd - lineStart;
+		if (lineLength > 0 && script[lineEnd - 1] == '\r')
+			lineLength--;
+
+		string line = trim(string(script.substr(lineStart, lineLength)));
+		if (!startsWith(line, "//") && line != "")
 		{ // dont include line if it is a comment or if it is blank
-			lines.push_back(trim(beforeProcessLines.at(i)));
+			lines.push_back(line);
 		}
+		lineStart = lineEnd + 1;
 	}
 #if DEVELOPER_MESSAGES
 	InterpreterLog("Contents:\n");
@@ -1238,12 +1548,73 @@ int parseHolyZ(string script)
 		cout << unWrapVec(words.at(i)) << endl;
 #endif
 	}
+	return words;
+}
 
-#if DEVELOPER_MESSAGES
-	InterpreterLog("Gather variables & functions...");
-#endif
-	// Go through entire script and iterate through all types to see if line is a variable
-	// or function declaration, then store it with it's value
+// Name the builtin prelude from ZS.h is parsed under
+const string builtinModule = "ZS.h";
+
+// Module each script function and class was loaded from, to catch redefinitions
+unordered_map<string, string> definitionModules;
+
+// Warns when a function or class name is defined a second time, as the new
+// definition silently replaces the first one
+void CheckRedefinition(const string& kind, const string& name, const string& modulePath)
+{
+	auto previous = definitionModules.find(kind + " " + name);
+	if (previous != definitionModules.end() && previous->second != builtinModule)
+		LogWarning(kind + " \'" + name + "\' in " + modulePath + " redefines the one in " + previous->second);
+	definitionModules[kind + " " + name] = modulePath;
+}
+
+// Recognizes the two wrapper forms used by the prelude, where the call passes
+// exactly the function's parameters in order:
+//   ZS.Name(a, b)
+// and
+//   <type> out = ZS.Name(a, b)
+//   return out
+bool FindNativeBinding(const vector<vector<string>>& functionContents, NativeBinding& binding)
+{
+	vector<const vector<string>*> body;
+	for (int i = 1; i < (int)functionContents.size(); i++)
+		if (unWrapVec(functionContents.at(i)) != "{")
+			body.push_back(&functionContents.at(i));
+
+	string call;
+	if (body.size() == 1 && startsWith(body[0]->at(0), "ZS."))
+	{
+		call = unWrapVec(*body[0]);
+		binding.returnsValue = false;
+		binding.returnType = StaticType::Dynamic;
+	}
+	else if (body.size() == 2 && body[0]->size() >= 4 && countInVector(types, body[0]->at(0)) > 0 && body[0]->at(2) == "="
+		&& startsWith(body[0]->at(3), "ZS.") && body[1]->size() == 2 && IsKeyword(body[1]->at(0), "return") && body[1]->at(1) == body[0]->at(1))
+	{
+		call = unWrapVec(slice(*body[0], 3, -1));
+		binding.returnsValue = true;
+		binding.returnType = StaticTypeOf(body[0]->at(0));
+	}
+	else
+		return false;
+
+	size_t open = call.find('(');
+	if (open == string::npos || call.back() != ')' || count(call, ')') != 1)
+		return false;
+	if (split(replace(call.substr(open + 1, call.size() - open - 2), " ", ""), ',') != functionContents.at(0))
+		return false;
+
+	binding.nativeName = call.substr(0, open);
+	binding.paramCount = functionContents.at(0).size();
+	return true;
+}
+
+// Splits tokenized lines into the script's top level declarations: functions
+// with their parameters and bodies, classes with their bodies, and the
+// statements between them. This is the form scripts are cached in
+ParsedScript ParseScript(string_view script)
+{
+	vector<vector<string>> words = TokenizeScript(script);
+	ParsedScript program;
 	for (int lineNum = 0; lineNum < (int)words.size(); lineNum++)
 	{
 		//Checks if it is function
@@ -1252,10 +1623,6 @@ int parseHolyZ(string script)
 			vector<vector<string>> functionContents;
 
 			string functName = split(words.at(lineNum).at(1), '(')[0];
-#if DEVELOPER_MESSAGES == true
-			InterpreterLog("Load script function " + functName + "...");
-#endif
-
 			//string args = "";
 			//if (indexInStr(unWrapVec(words.at(lineNum)), ')') - indexInStr(unWrapVec(words.at(lineNum)), '(') > 1)
 			//	for (int w = 0; w < (int)words.at(lineNum).size(); w++) // Get all words from the instantiation line: these are the args
@@ -1282,15 +1649,12 @@ int parseHolyZ(string script)
 				//cout << functName << "<" << args << ">" << endl;
 				lineNum++;
 			}
-			
-			functionValues[functName] = functionContents;
+
+			program.push_back(Declaration{ 'f', functName, std::move(functionContents) });
 		}
 		else if (toLower(words.at(lineNum).at(0)) == "class")
 		{
 			string className = words.at(lineNum).at(1);
-			ClassDefinition classDef(className);
-			
-			// Parse class body for methods and attributes
 			int numOfBrackets = countInVector(words.at(lineNum), "{") - countInVector(words.at(lineNum), "}");
 			lineNum++;
 			vector<vector<string>> classBodyLines;
@@ -1303,7 +1667,47 @@ int parseHolyZ(string script)
 				}
 				lineNum++;
 			}
-			
+
+			program.push_back(Declaration{ 'c', className, std::move(classBodyLines) });
+		}
+		else
+			program.push_back(Declaration{ 's', "", { words.at(lineNum) } });
+	}
+	return program;
+}
+
+// Loads parsed declarations into the program: functions and classes are
+// defined and global variables initialized, in source order. The declarations
+// are moved out of program
+int parseHolyZ(ParsedScript& program, const string& modulePath = "")
+{
+#if DEVELOPER_MESSAGES
+	InterpreterLog("Gather variables & functions...");
+#endif
+	for (Declaration& declaration : program)
+	{
+		if (declaration.kind == 'f')
+		{
+			const string& functName = declaration.name;
+			vector<vector<string>>& functionContents = declaration.lines;
+#if DEVELOPER_MESSAGES == true
+			InterpreterLog("Load script function " + functName + "...");
+#endif
+			CheckRedefinition("function", functName, modulePath);
+			NativeBinding binding;
+			if (FindNativeBinding(functionContents, binding))
+				nativeBindings[functName] = binding;
+			else
+				nativeBindings.erase(functName);
+			functionValues[functName] = std::move(functionContents);
+			callSites.clear();
+		}
+		else if (declaration.kind == 'c')
+		{
+			const string& className = declaration.name;
+			const vector<vector<string>>& classBodyLines = declaration.lines;
+			ClassDefinition classDef(className);
+
 			// Parse methods and attributes from class body
 			for (size_t i = 0; i < classBodyLines.size(); i++) {
 				if (classBodyLines[i].size() > 0) {
@@ -1357,77 +1761,60 @@ int parseHolyZ(string script)
 				}
 			}
 			
+			CheckRedefinition("class", className, modulePath);
 			globalClassDefinitions[className] = classDef;
+			classShapeEpoch++;
 #if DEVELOPER_MESSAGES == true
 			InterpreterLog("Load script class " + className + "...");
 #endif
 		}
 		else
 		{
-			if (IsKeyword(words.at(lineNum).at(0), "include"))
+			const vector<string>& line = declaration.lines.at(0);
+			// Included scripts are loaded once by the module loader, and
+			// parsed before the scripts that include them
+			if (IsKeyword(line.at(0), "include"))
 			{
-				string scriptPath = StringRaw(words.at(lineNum).at(1));
-				string scriptTextContents;
 #if DEVELOPER_MESSAGES == true
-				InterpreterLog("Including from " + words.at(lineNum).at(1) + "...");
-#endif
-#if UNIX
-				// Get script contents as single string
-				auto ss = ostringstream{};
-				ifstream input_file(scriptPath);
-				ss << input_file.rdbuf();
-				scriptTextContents = ss.str();
-#if DEVELOPER_MESSAGES
-				InterpreterLog("Gather script contents...");
-#endif
-#elif WINDOWS
-				// Get script contents as single string
-				ifstream script(scriptPath);
-				stringstream scriptString;
-				scriptString << script.rdbuf();
-				scriptTextContents = scriptString.str();
-#if DEVELOPER_MESSAGES
-				InterpreterLog("Gather script contents...");
-#endif
+				InterpreterLog("Including from " + line.at(1) + "...");
 #endif
-				parseHolyZ(scriptTextContents);
 			}
 
 
-			else if (IsKeyword(words.at(lineNum).at(0), "string")) {
-				globalVariableValues[words.at(lineNum).at(1)] = StringRaw(words.at(lineNum).at(3));
+			else if (IsKeyword(line.at(0), "string")) {
+				globalVariableValues[line.at(1)] = StringRaw(line.at(3));
 #if DEVELOPER_MESSAGES == true
-				InterpreterLog("Load script variable " + words.at(lineNum).at(1) + "...");
+				InterpreterLog("Load script variable " + line.at(1) + "...");
 #endif
 			}
 
 			// Iterate through all types to see if line inits or
 			// re-inits a variable then store it with it's value
-			else if (countInVector(types, trim(words.at(lineNum).at(0))) > 0)
+			else if (countInVector(types, trim(line.at(0))) > 0)
 			{
-				//cout << words.at(lineNum).at(1) << "=" << unWrapVec(slice(words.at(lineNum), 3, -1)) << "=" << AnyAsString(EvalExpression(unWrapVec(slice(words.at(lineNum), 3, -1)), variableValues)) << endl;
-				globalVariableValues[words.at(lineNum).at(1)] = EvalExpression(unWrapVec(slice(words.at(lineNum), 3, -1)), globalVariableValues);
+				//cout << line.at(1) << "=" << unWrapVec(slice(line, 3, -1)) << "=" << AnyAsString(EvalExpression(unWrapVec(slice(line, 3, -1)), variableValues)) << endl;
+				globalVariableValues[line.at(1)] = ToDeclaredType(StaticTypeOf(trim(line.at(0))), EvalExpression(unWrapVec(slice(line, 3, -1)), globalVariableValues));
 			}
-			//			else if (words.at(lineNum).at(0) == "int") {
-			//				globalVariableValues[words.at(lineNum).at(1)] = stoi(words.at(lineNum).at(3));
+			//			else if (line.at(0) == "int") {
+			//				globalVariableValues[line.at(1)] = stoi(line.at(3));
 			//#if DEVELOPER_MESSAGES == true
-			//				InterpreterLog("Load script variable " + words.at(lineNum).at(1) + "...");
+			//				InterpreterLog("Load script variable " + line.at(1) + "...");
 			//#endif
 			//			}
-			//			else if (words.at(lineNum).at(0) == "float") {
-			//				globalVariableValues[words.at(lineNum).at(1)] = stof(words.at(lineNum).at(3));
+			//			else if (line.at(0) == "float") {
+			//				globalVariableValues[line.at(1)] = stof(line.at(3));
 			//#if DEVELOPER_MESSAGES == true
-			//				InterpreterLog("Load script variable " + words.at(lineNum).at(1) + "...");
+			//				InterpreterLog("Load script variable " + line.at(1) + "...");
 			//#endif
 			//			}
-			//			else if (words.at(lineNum).at(0) == "bool") {
-			//				globalVariableValues[words.at(lineNum).at(1)] = stob(words.at(lineNum).at(3));
+			//			else if (line.at(0) == "bool") {
+			//				globalVariableValues[line.at(1)] = stob(line.at(3));
 			//#if DEVELOPER_MESSAGES == true
-			//				InterpreterLog("Load script variable " + words.at(lineNum).at(1) + "...");
+			//				InterpreterLog("Load script variable " + line.at(1) + "...");
 			//#endif
 			//			}
 			else
-				LogWarning("unrecognized type \'" + words.at(lineNum).at(0) + "\' on line: " + to_string(lineNum));
+				LogWarning("unrecognized type \'" + line.at(0) + "\' in: " + unWrapVec(line));
 		}
 	}
 
@@ -1435,31 +1822,155 @@ int parseHolyZ(string script)
 }
 // Holy C type conversion functions
 
-int main(int argc, char* argv[])
-{
-if (argc > 1)
-{
-// Run script from file
-string scriptPath = argv[1];
-ifstream scriptFile(scriptPath);
-if (!scriptFile.is_open())
+// Loads the builtin prelude embedded from ZS.h. It is tokenized straight from
+// memory, and its native wrappers are bound while it is parsed
+void LoadBuiltins()
 {
-cerr << "Error: Could not open file '" << scriptPath << "'" << endl;
-return 1;
+	ParsedScript builtins = ParseScript(ZSContents);
+	parseHolyZ(builtins, builtinModule);
 }
 
-stringstream scriptBuffer;
-scriptBuffer << scriptFile.rdbuf();
-string scriptContents = scriptBuffer.str();
-scriptFile.close();
+// Translates the script's functions that are in the native subset to C++,
+// builds them into a library beside the script and binds them. Functions
+// outside the subset, and the prelude, stay interpreted
+void CompileScriptFunctions(const string& scriptPath)
+{
+	unordered_map<string, vector<vector<string>>> scriptFunctions;
+	for (const auto& function : functionValues)
+	{
+		auto module = definitionModules.find("function " + function.first);
+		if (module == definitionModules.end() || module->second != builtinModule)
+			scriptFunctions.insert(function);
+	}
 
-parseHolyZ(scriptContents);
+	Transpiler::Result result = Transpiler::transpile(scriptFunctions, types, scriptPath + " (" + NAMEVERSION + ")");
+	for (const auto& skipped : result.skipped)
+		InterpreterLog("Function " + skipped.first + " stays interpreted, it " + skipped.second);
+	if (result.functions.empty())
+		return;
+
+	string stem = scriptPath;
+	size_t dot = stem.find_last_of('.');
+	if (dot != string::npos && (stem.find_last_of("/\\") == string::npos || dot > stem.find_last_of("/\\")))
+		stem.erase(dot);
+#if WINDOWS
+	string libraryPath = stem + ".native.dll";
+#else
+	string libraryPath = stem + ".native.so";
+#endif
+	if (!CppEmbedding::compileCppBlock(result.source, libraryPath))
+	{
+		LogWarning("could not compile " + libraryPath + ", running every function interpreted");
+		return;
+	}
+	void* library = CppEmbedding::loadDynamicLibrary(libraryPath);
+	if (library == nullptr)
+	{
+		LogWarning("could not load " + libraryPath + ", running every function interpreted");
+		return;
+	}
+
+	// The library stays loaded until the interpreter exits
+	for (const Transpiler::Function& function : result.functions)
+	{
+		void* entry = CppEmbedding::getFunctionAddress(library, Transpiler::entryPointName(function.name));
+		if (entry != nullptr)
+			compiledFunctions[function.name] = { (Transpiler::EntryPoint)entry, function.paramCount, function.returnsValue, StaticTypeOf(function.returnType) };
+	}
+	InterpreterLog("Compiled " + to_string(compiledFunctions.size()) + " of " + to_string(scriptFunctions.size()) + " functions to " + libraryPath);
 }
-else
+
+// Loads a script and all of the scripts it includes, each one once, parses
+// them with dependencies first, optimizes the program and runs Main
+int parseHolyZFile(const string& scriptPath)
 {
-// Run REPL
-RunREPL();
+	ModuleLoader::ModuleGraph modules;
+	if (!modules.load(scriptPath, NAMEVERSION, ParseScript))
+		return 1;
+
+	for (const string& missing : modules.missingIncludes())
+		LogWarning("could not open included script \'" + missing + "\'");
+	vector<size_t> order = modules.order();
+	for (const string& cycle : modules.cycles())
+		LogWarning("include cycle " + cycle + ", the last include is skipped");
+
+	for (size_t index : order)
+	{
+#if DEVELOPER_MESSAGES == true
+		InterpreterLog("Parsing module " + modules.at(index).path + "...");
+#endif
+		parseHolyZ(modules.at(index).program, modules.at(index).path);
+	}
+
+	if (emitCpp)
+		CompileScriptFunctions(scriptPath);
+	OptimizeProgram(functionValues, globalVariableValues, globalClassDefinitions, optimizationLevel);
+	TypeProgram(functionValues, optimizationLevel);
+
+	// Executes main, which is the entry point function
+	if (IsFunction("Main"))
+		ExecuteFunction("Main", vector<boost::any> {});
+	return 0;
 }
 
-return 0;
+int main(int argc, char* argv[])
+{
+	string scriptPath;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--no-cache")
+			ScriptCache::setEnabled(false);
+		else if (arg == "--cache-dir" && i + 1 < argc)
+			ScriptCache::setCacheDir(argv[++i]);
+		else if (arg == "--opt-level" && i + 1 < argc)
+			optimizationLevel = atoi(argv[++i]);
+		else if (arg == "--parse-threads" && i + 1 < argc)
+			ModuleLoader::setThreads(atoi(argv[++i]));
+		else if (arg == "--emit-cpp")
+			emitCpp = true;
+		else if (arg == "--jit")
+		{
+			jitEnabled = Jit::isSupported();
+			if (!jitEnabled)
+				LogWarning("--jit ignored, this build has no JIT (configure with -DHOLYZ_ENABLE_JIT=ON on x86-64 Linux)");
+		}
+		else if ((arg == "--headless" || arg == "--dump-frames") && i + 1 < argc)
+		{
+#ifdef HOLYZ_GRAPHICS_ENABLED
+			if (arg == "--headless")
+				HEADLESS_FRAMES = max(atoi(argv[++i]), 1);
+			else
+				FRAME_DUMP_DIR = argv[++i];
+#else
+			i++;
+			LogWarning(arg + " ignored, this build has no graphics (configure with -DHOLYZ_ENABLE_GRAPHICS=ON)");
+#endif
+		}
+		else if (scriptPath.empty())
+			scriptPath = arg;
+	}
+#ifdef HOLYZ_GRAPHICS_ENABLED
+	if (!FRAME_DUMP_DIR.empty() && HEADLESS_FRAMES == 0)
+		LogWarning("--dump-frames ignored, frames are only dumped with --headless");
+#endif
+
+	LoadBuiltins();
+
+	if (!scriptPath.empty())
+	{
+		// Run script from file
+		if (parseHolyZFile(scriptPath) != 0)
+		{
+			cerr << "Error: Could not open file '" << scriptPath << "'" << endl;
+			return 1;
+		}
+	}
+	else
+	{
+		// Run REPL
+		RunREPL();
+	}
+
+	return 0;
 }
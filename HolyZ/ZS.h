@@ -88,15 +88,8 @@ func DegToRad(x)
 // Clamps input between min and max
 func Clamp(input, min, max)
 {
-	if input < min
-	{
-		return min
-	}
-	if input > max
-	{
-		return max
-	}
-	return input
+	float out = ZS.Math.Clamp(input, min, max)
+	return out
 }
 
 // Sets color of pixel to RGB value
@@ -152,19 +145,15 @@ func GetKey(keyName)
 // Return the number of combinations
 func Comb(n, r)
 {
-    return Perm(n, r) / Fac(r)
+    float out = ZS.Math.Comb(n, r)
+    return out
 }
 
 // Return the factorial of a number
 func Fac(x)
 {
-    int r = 1
-    while x > 1
-    {
-        r = r * x
-        x = x - 1
-    }
-    return r
+    float out = ZS.Math.Fac(x)
+    return out
 }
 
 // Return exp(x) by using the taylor method, not extremly accurate
@@ -187,22 +176,8 @@ func TaylorExp(x)
 // Return the number of permutations
 func Perm(n, r)
 {
-    if n < 0 
-    {
-        ZS.System.PrintLine("n must be superior or equal to 0")
-        return -1
-    }
-    if r < 0
-    {
-        ZS.System.PrintLine("r must be superior or equal to 0")
-        return -1
-    }
-    if r > n
-    {
-        ZS.System.PrintLine("r must be inferior or equal to n")
-        return -1
-    }
-    return Fac(n) / Fac(n - r)
+    float out = ZS.Math.Perm(n, r)
+    return out
 }
 
 //////////////////////////////////////////
@@ -220,34 +195,8 @@ func PercentToHundred(value, percent)
 	return temp
 }
 
-//////////////////////////////////////////
-// ↓ HOLY C ENHANCED FUNCTIONS ↓ //
-//////////////////////////////////////////
-
-// Holy C style type conversion functions
-func ToInt(value)
-{
-	int result = ZS.Math.Round(value)
-	return result
-}
-
-func ToFloat(value)
-{
-	float result = value + 0.0
-	return result
-}
-
-func ToStr(value)
-{
-	string result = value + ""
-	return result
-}
-
-func ToBool(value)
-{
-	bool result = value == true
-	return result
-}
+// Holy C style type conversion (ToInt, ToFloat, ToStr, ToBool) is built
+// into the interpreter
 
 )"
 ;
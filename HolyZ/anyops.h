@@ -5,6 +5,9 @@
 #include <boost/any.hpp>
 #include <string>
 #include <vector>
+#include <climits>
+
+#include "strops.h"
 
 // Forward declarations
 class ClassInstance;
@@ -144,6 +147,19 @@ float AnyAsFloat(const boost::any& val)
 	}
 }
 
+// Truncates toward zero. Values out of range saturate and NaN becomes 0,
+// where a plain cast would be undefined
+int SaturatingInt(double value)
+{
+	if (value != value)
+		return 0;
+	if (value >= (double)INT_MAX)
+		return INT_MAX;
+	if (value <= (double)INT_MIN)
+		return INT_MIN;
+	return (int)value;
+}
+
 // Will convert type 'any' val to an integer
 int AnyAsInt(const boost::any& val)
 {
@@ -157,13 +173,13 @@ int AnyAsInt(const boost::any& val)
 	{
 		try // Try converting to float
 		{
-			return (int)any_cast<float>(val);
+			return SaturatingInt(any_cast<float>(val));
 		}
 		catch (boost::bad_any_cast)
 		{
 			try // Try converting to string, then converting it to int
 			{
-				return stoi(any_cast<string>(val));
+				return SaturatingInt(stod(any_cast<string>(val)));
 			}
 			catch (boost::bad_any_cast) // Try converting to bool
 			{
@@ -215,6 +231,18 @@ Vec2 AnyAsVec2(const boost::any& val)
 }
 #endif // HOLYZ_GRAPHICS_ENABLED
 
+// Whether a value can be used as a number: an int, a float, or the text of one
+bool IsNumericValue(const boost::any& val)
+{
+	if (val.type() == typeid(int) || val.type() == typeid(float))
+		return true;
+	if (val.type() != typeid(string))
+		return false;
+	const string& text = any_cast<const string&>(val);
+	size_t start = !text.empty() && text[0] == '-' ? 1 : 0;
+	return text.size() > start && text != "." && text.substr(start) != "." && isNumber(text.substr(start));
+}
+
 // Will get type 'any' val to a ClassInstance
 ClassInstance AnyAsClassInstance(const boost::any& val);
 
@@ -28,8 +28,11 @@
 #include "strops.h"
 #ifdef HOLYZ_GRAPHICS_ENABLED
 #include "graphics.h"
+#include "physics.h"
 #endif
 #include "anyops.h"
+#include "system_control.h"
+#include "vec_buffer.h"
 #if WINDOWS
 #include "color.hpp"
 #endif
@@ -197,6 +200,11 @@ bool any_compare(const boost::any& a, const boost::any& b)
 	if (a.empty() && b.empty()) return true;
 	if (a.empty() || b.empty()) return false;
 	
+	// Numbers compare by value, also against the text of a number
+	if ((a.type() == typeid(int) || a.type() == typeid(float) || b.type() == typeid(int) || b.type() == typeid(float))
+		&& a.type() != b.type() && IsNumericValue(a) && IsNumericValue(b))
+		return AnyAsFloat(a) == AnyAsFloat(b);
+	
 	// Try int comparison
 	try {
 		return any_cast<int>(a) == any_cast<int>(b);
@@ -223,84 +231,27 @@ bool any_compare(const boost::any& a, const boost::any& b)
 
 int any_type(const boost::any& val)
 {
-	try // Try converting to int
-	{
-		int i = any_cast<int>(val);
+	// Compares the stored type directly, as this runs for most assignments
+	const std::type_info& type = val.type();
+	if (type == typeid(int))
 		return 0;
-	}
-	catch (boost::bad_any_cast)
-	{
-		try // Try converting to float
-		{
-			float f = any_cast<float>(val);
-			return 1;
-		}
-		catch (boost::bad_any_cast)
-		{
-			try // Try converting to bool
-			{
-				bool b = any_cast<bool>(val);
-				return 2;
-			}
-			catch (boost::bad_any_cast) // Try converting to string
-			{
-				try
-				{
-					string s = any_cast<string>(val);
-					return 3;
-				}
-				catch (boost::bad_any_cast) // Try converting to sprite
-				{
+	if (type == typeid(float))
+		return 1;
+	if (type == typeid(bool))
+		return 2;
+	if (type == typeid(string))
+		return 3;
 #ifdef HOLYZ_GRAPHICS_ENABLED
-					try
-					{
-						Sprite s = any_cast<Sprite>(val);
-						return 4;
-					}
-					catch (boost::bad_any_cast) // Try converting to Vec2
-					{
-						try
-						{
-							Vec2 v = any_cast<Vec2>(val);
-							return 5;
-						}
-						catch (boost::bad_any_cast) // Try converting to Text
-						{
-							try
-							{
-								Text t = any_cast<Text>(val);
-								return 6;
-							}
-							catch (boost::bad_any_cast) // Try Class Instance
-							{
-								try
-								{
-									ClassInstance ci = any_cast<ClassInstance>(val);
-									return 7;
-								}
-								catch (boost::bad_any_cast) // Does not convert, return
-								{
-									return -1; // Unknown type
-								}
-							}
-						}
-					}
-#else
-					// Graphics disabled, try ClassInstance directly
-					try
-					{
-						ClassInstance ci = any_cast<ClassInstance>(val);
-						return 7;
-					}
-					catch (boost::bad_any_cast) // Does not convert, return
-					{
-						return -1; // Unknown type
-					}
+	if (type == typeid(Sprite))
+		return 4;
+	if (type == typeid(Vec2))
+		return 5;
+	if (type == typeid(Text))
+		return 6;
 #endif
-				}
-			}
-		}
-	}
+	if (type == typeid(ClassInstance))
+		return 7;
+	return -1; // Unknown type
 }
 
 //unordered_map<string, vector<vector<string>>> builtinFunctionValues;
@@ -784,9 +735,43 @@ boost::any EditClassSubComponent(boost::any value, string oper, boost::any other
 //	return 0;
 //}
 
+// Factorial, permutations and combinations in float math, which is what the
+// interpreter's arithmetic works in
+boost::any MathFactorial(float x)
+{
+	float r = 1;
+	for (; x > 1; x--)
+		r *= x;
+	return r;
+}
+
+boost::any MathPermutations(float n, float r)
+{
+	if (n < 0)
+	{
+		cout << "n must be superior or equal to 0" << endl;
+		return -1;
+	}
+	if (r < 0)
+	{
+		cout << "r must be superior or equal to 0" << endl;
+		return -1;
+	}
+	if (r > n)
+	{
+		cout << "r must be inferior or equal to n" << endl;
+		return -1;
+	}
+	return AnyAsFloat(MathFactorial(n)) / AnyAsFloat(MathFactorial(n - r));
+}
+
 // Executes 
 boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 {
+	// Functions registered by native modules
+	if (const CppEmbedding::ModuleFunction* moduleFunction = CppEmbedding::findModuleFunction(name))
+		return CppEmbedding::callModuleFunction(name, *moduleFunction, args);
+
 	if (name == "ZS.Math.Sin")
 		return sin(AnyAsFloat(args.at(0)));
 	else if (name == "ZS.Math.Cos")
@@ -799,6 +784,20 @@ boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 		return lerp(AnyAsFloat(args.at(0)), AnyAsFloat(args.at(1)), AnyAsFloat(args.at(2)));
 	else if (name == "ZS.Math.Abs")
 		return abs(AnyAsFloat(args.at(0)));
+	else if (name == "ZS.Math.Clamp")
+	{
+		if (AnyAsFloat(args.at(0)) < AnyAsFloat(args.at(1)))
+			return args.at(1);
+		if (AnyAsFloat(args.at(0)) > AnyAsFloat(args.at(2)))
+			return args.at(2);
+		return args.at(0);
+	}
+	else if (name == "ZS.Math.Fac")
+		return MathFactorial(AnyAsFloat(args.at(0)));
+	else if (name == "ZS.Math.Perm")
+		return MathPermutations(AnyAsFloat(args.at(0)), AnyAsFloat(args.at(1)));
+	else if (name == "ZS.Math.Comb")
+		return AnyAsFloat(MathPermutations(AnyAsFloat(args.at(0)), AnyAsFloat(args.at(1)))) / AnyAsFloat(MathFactorial(AnyAsFloat(args.at(1))));
 #ifdef HOLYZ_GRAPHICS_ENABLED
 	else if (name == "ZS.Graphics.Init")
 	{
@@ -810,6 +809,14 @@ boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 		else
 			initGraphics(StringRaw(AnyAsString(args.at(0))), AnyAsInt(args.at(1)), AnyAsInt(args.at(2)), AnyAsInt(args.at(3)));
 	}
+	else if (name == "ZS.Graphics.FixedTimestep")
+		FIXED_TIMESTEP = AnyAsFloat(args.at(0)) > 0 ? 1.0f / AnyAsFloat(args.at(0)) : 0.0f;
+	else if (name == "ZS.Graphics.FrameLimit")
+		FRAME_LIMIT = AnyAsFloat(args.at(0));
+	else if (name == "ZS.Graphics.VSync")
+		VSYNC = AnyAsBool(args.at(0));
+	else if (name == "ZS.Graphics.Alpha")
+		return interpolationAlpha;
 	else if (name == "ZS.Graphics.Sprite")
 	{
 		string path = StringRaw(AnyAsString(args.at(0)));
@@ -821,15 +828,35 @@ boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 		Sprite s(StringRaw(AnyAsString(args.at(0))), any_cast<Vec2>(args.at(1)), any_cast<Vec2>(args.at(2)), AnyAsFloat(args.at(3)));
 		return s;
 	}
-	else if (name == "ZS.Graphics.DrawPixel")
-	{
-		SDL_SetRenderDrawColor(gRenderer, AnyAsInt(args.at(2)), AnyAsInt(args.at(3)), AnyAsInt(args.at(4)), 255);
-		SDL_RenderDrawPoint(gRenderer, AnyAsInt(args.at(0)), AnyAsInt(args.at(1)));
-		SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 0);
-	}
-		//DrawPixel(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), AnyAsInt(args.at(2)), AnyAsInt(args.at(3)), AnyAsInt(args.at(4)));
+	else if (name == "ZS.Graphics.DrawPixel" || name == "ZS.Graphics.SetPixel")
+		framebuffer.set(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), Framebuffer::color(AnyAsInt(args.at(2)), AnyAsInt(args.at(3)), AnyAsInt(args.at(4))));
+	else if (name == "ZS.Graphics.DrawSpan")
+		framebuffer.fill(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), AnyAsInt(args.at(2)), 1, Framebuffer::color(AnyAsInt(args.at(3)), AnyAsInt(args.at(4)), AnyAsInt(args.at(5))));
+	else if (name == "ZS.Graphics.FillPixels")
+		framebuffer.fill(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), AnyAsInt(args.at(2)), AnyAsInt(args.at(3)), Framebuffer::color(AnyAsInt(args.at(4)), AnyAsInt(args.at(5)), AnyAsInt(args.at(6))));
 	else if (name == "ZS.Graphics.Draw")
 		any_cast<Sprite>(args.at(0)).Draw();
+	else if (name == "ZS.Graphics.Camera")
+	{
+		// A Vec2 or x and y, then an optional zoom
+		int next = 1;
+		if (any_type(args.at(0)) == 5)
+			camera.position = any_cast<Vec2>(args.at(0));
+		else
+		{
+			camera.position = Vec2(AnyAsFloat(args.at(0)), AnyAsFloat(args.at(1)));
+			next = 2;
+		}
+		camera.zoom = (int)args.size() > next ? AnyAsFloat(args.at(next)) : 1.0f;
+		camera.enabled = true;
+	}
+	else if (name == "ZS.Graphics.ResetCamera")
+		camera = Camera();
+	else if (name == "ZS.Graphics.DrawAll")
+	{
+		for (const boost::any& arg : args)
+			any_cast<Sprite>(arg).Draw();
+	}
 	else if (name == "ZS.Graphics.Load")
 		any_cast<Sprite>(args.at(0)).Load();
 	else if (name == "ZS.Graphics.Text")
@@ -859,8 +886,62 @@ boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 	{
 		return AxisAlignedCollision(any_cast<Sprite>(args.at(0)), any_cast<Sprite>(args.at(1)));
 	}
+	else if (name == "ZS.Physics.RotatedCollision")
+	{
+		Sprite a = any_cast<Sprite>(args.at(0));
+		Sprite b = any_cast<Sprite>(args.at(1));
+		_RotRect boxA = { a.position, a.scale / 2, (float)(a.angle * 3.14159265 / 180.0) };
+		_RotRect boxB = { b.position, b.scale / 2, (float)(b.angle * 3.14159265 / 180.0) };
+		return RotRectsCollision(&boxA, &boxB) != 0;
+	}
+	else if (name == "ZS.Physics.World")
+	{
+		physicsWorlds.emplace_back(args.empty() ? 64.0f : AnyAsFloat(args.at(0)));
+		return (int)physicsWorlds.size() - 1;
+	}
+	else if (name == "ZS.Physics.Add")
+	{
+		// A Sprite, or the center, size and angle of a box
+		PhysicsWorld* world = GetPhysicsWorld(AnyAsInt(args.at(0)));
+		if (world == nullptr)
+			return nullType;
+		if (any_type(args.at(2)) == 4)
+		{
+			Sprite s = any_cast<Sprite>(args.at(2));
+			world->set(AnyAsInt(args.at(1)), s.position, s.scale, (float)s.angle);
+		}
+		else
+			world->set(AnyAsInt(args.at(1)), Vec2(AnyAsFloat(args.at(2)), AnyAsFloat(args.at(3))), Vec2(AnyAsFloat(args.at(4)), AnyAsFloat(args.at(5))), args.size() > 6 ? AnyAsFloat(args.at(6)) : 0.0f);
+	}
+	else if (name == "ZS.Physics.Remove")
+	{
+		PhysicsWorld* world = GetPhysicsWorld(AnyAsInt(args.at(0)));
+		return world != nullptr && world->remove(AnyAsInt(args.at(1)));
+	}
+	else if (name == "ZS.Physics.QueryOverlaps")
+	{
+		PhysicsWorld* world = GetPhysicsWorld(AnyAsInt(args.at(0)));
+		return world == nullptr ? 0 : (int)world->queryOverlaps().size();
+	}
+	else if (name == "ZS.Physics.PairA" || name == "ZS.Physics.PairB")
+	{
+		// Ids of a pair found by the last QueryOverlaps
+		PhysicsWorld* world = GetPhysicsWorld(AnyAsInt(args.at(0)));
+		int index = AnyAsInt(args.at(1));
+		if (world == nullptr || index < 0 || index >= (int)world->lastOverlaps().size())
+			return -1;
+		const pair<int, int>& overlap = world->lastOverlaps()[index];
+		return name == "ZS.Physics.PairA" ? overlap.first : overlap.second;
+	}
 	else if (name == "ZS.Input.GetKey")
-		return KEYS[StringRaw(any_cast<string>(args.at(0)))] == 1;
+	{
+		// Takes a key name, or a scancode from ZS.Input.KeyCode
+		if (args.at(0).type() == typeid(int))
+			return keyDown(any_cast<int>(args.at(0)));
+		return keyDown(scancodeFromKeyName(StringRaw(AnyAsString(args.at(0)))));
+	}
+	else if (name == "ZS.Input.KeyCode")
+		return (int)scancodeFromKeyName(StringRaw(AnyAsString(args.at(0))));
 	else if (name == "ZS.System.Vec2")
 	{
 		Vec2 v(AnyAsFloat(args.at(0)), AnyAsFloat(args.at(1)));
@@ -878,6 +959,114 @@ boost::any ZSFunction(const string& name, const vector<boost::any>& args)
 		//strcpy(command_char_arr, command.c_str()); // string into char arr
 		int k = system(command.c_str());
 	}
+	else if (name == "ZS.System.Spawn")
+		return Process::spawn(StringRaw(AnyAsString(args.at(0))));
+	else if (name == "ZS.System.ReadOutput")
+		return Process::readOutput(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.ReadError")
+		return Process::readError(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.Poll")
+		return Process::poll(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.Wait")
+		return Process::wait(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.Release")
+		return Process::release(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.MaxProcesses")
+		Process::setMaxConcurrent(AnyAsInt(args.at(0)));
+	else if (name == "ZS.System.LoadModule")
+		return CppEmbedding::loadModule(StringRaw(AnyAsString(args.at(0))));
+	else if (name == "ZS.File.Open")
+		return FileSystem::openStream(StringRaw(AnyAsString(args.at(0))), args.size() > 1 ? StringRaw(AnyAsString(args.at(1))) : "r");
+	else if (name == "ZS.File.ReadLine")
+	{
+		string line;
+		FileSystem::FileStream* stream = FileSystem::getStream(AnyAsInt(args.at(0)));
+		if (stream)
+			stream->readLine(line);
+		return line;
+	}
+	else if (name == "ZS.File.ReadChunk")
+	{
+		int count = AnyAsInt(args.at(1));
+		if (count <= 0)
+		{
+			LogWarning("ZS.File.ReadChunk needs a positive byte count, got " + to_string(count));
+			return string();
+		}
+		FileSystem::FileStream* stream = FileSystem::getStream(AnyAsInt(args.at(0)));
+		if (stream)
+			return stream->readChunk((size_t)count);
+		return string();
+	}
+	else if (name == "ZS.File.Write")
+	{
+		// Every argument after the handle is appended, in order
+		FileSystem::FileStream* stream = FileSystem::getStream(AnyAsInt(args.at(0)));
+		if (!stream)
+			return false;
+		for (int i = 1; i < (int)args.size(); i++)
+			if (!stream->write(StringRaw(AnyAsString(args.at(i)))))
+				return false;
+		return true;
+	}
+	else if (name == "ZS.File.EndOfFile")
+	{
+		FileSystem::FileStream* stream = FileSystem::getStream(AnyAsInt(args.at(0)));
+		return stream == nullptr || stream->endOfFile();
+	}
+	else if (name == "ZS.File.Close")
+		return FileSystem::closeStream(AnyAsInt(args.at(0)));
+	else if (name == "ZS.File.WriteAll")
+		return FileSystem::writeAll(StringRaw(AnyAsString(args.at(0))), StringRaw(AnyAsString(args.at(1))));
+	else if (name == "ZS.File.Walk")
+		return FileSystem::openWalk(StringRaw(AnyAsString(args.at(0))), args.size() > 1 ? AnyAsBool(args.at(1)) : true, args.size() > 2 ? AnyAsInt(args.at(2)) : 1);
+	else if (name == "ZS.File.WalkNext")
+	{
+		// One record per line: type, size, modified time and path, tab separated
+		int count = args.size() > 1 ? AnyAsInt(args.at(1)) : 1024;
+		if (count <= 0)
+		{
+			// An empty batch would never finish the walk
+			LogWarning("ZS.File.WalkNext needs a positive entry count, got " + to_string(count) + ", reading 1");
+			count = 1;
+		}
+		string records;
+		for (const auto& entry : FileSystem::walkNext(AnyAsInt(args.at(0)), (size_t)count))
+			records += string(1, entry.type) + "\t" + to_string(entry.size) + "\t" + to_string(entry.modifiedTime) + "\t" + entry.path + "\n";
+		return records;
+	}
+	else if (name == "ZS.File.WalkDone")
+		return FileSystem::walkDone(AnyAsInt(args.at(0)));
+	else if (name == "ZS.File.WalkClose")
+		return FileSystem::closeWalk(AnyAsInt(args.at(0)));
+	else if (name == "ZS.Vec.Buffer")
+		return VecBuffer::create(max(AnyAsInt(args.at(0)), 0), args.size() > 1 ? AnyAsFloat(args.at(1)) : 0.0f, args.size() > 2 ? AnyAsFloat(args.at(2)) : 0.0f);
+	else if (name == "ZS.Vec.Free")
+		return VecBuffer::release(AnyAsInt(args.at(0)));
+	else if (name == "ZS.Vec.Size")
+		return (int)VecBuffer::size(AnyAsInt(args.at(0)));
+	else if (name == "ZS.Vec.Set")
+		return VecBuffer::set(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), AnyAsFloat(args.at(2)), AnyAsFloat(args.at(3)));
+	else if (name == "ZS.Vec.X")
+		return VecBuffer::getX(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)));
+	else if (name == "ZS.Vec.Y")
+		return VecBuffer::getY(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)));
+#ifdef HOLYZ_GRAPHICS_ENABLED
+	else if (name == "ZS.Vec.Get")
+		return Vec2(VecBuffer::getX(AnyAsInt(args.at(0)), AnyAsInt(args.at(1))), VecBuffer::getY(AnyAsInt(args.at(0)), AnyAsInt(args.at(1))));
+#endif
+	else if (name == "ZS.Vec.Fill")
+		return VecBuffer::fill(AnyAsInt(args.at(0)), AnyAsFloat(args.at(1)), AnyAsFloat(args.at(2)));
+	else if (name == "ZS.Vec.AddScaled")
+		return VecBuffer::addScaled(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)), AnyAsFloat(args.at(2)));
+	else if (name == "ZS.Vec.Length")
+		return VecBuffer::length(AnyAsInt(args.at(0)), AnyAsInt(args.at(1)));
+	else if (name == "ZS.Vec.Normalize")
+		return VecBuffer::normalize(AnyAsInt(args.at(0)));
+	else if (name == "ZS.Vec.Clamp")
+		return VecBuffer::clamp(AnyAsInt(args.at(0)), AnyAsFloat(args.at(1)), AnyAsFloat(args.at(2)), AnyAsFloat(args.at(3)), AnyAsFloat(args.at(4)));
+	else if (name == "ZS.Vec.InstructionSet")
+		return string(VecBuffer::instructionSet());
 	else
 		LogWarning("ZS function \'" + name + "\' does not exist.");
 
@@ -1049,5 +1238,89 @@ boost::any GetStaticAttribute(const string& className, const string& attributeNa
 	return nullType;
 }
 
+// Bumped whenever a class definition is added or replaced, which empties every
+// attribute site cache
+unsigned int classShapeEpoch = 0;
+
+// Inline cache of one attribute access site, like "obj.attr" or
+// "ClassName.member". Each entry remembers, for one class, where the static
+// value of the attribute lives, so a repeated access is a compare and a load
+// instead of a walk through globalClassDefinitions and the superclass chain.
+// Sites seeing more than maxEntries classes fall back to the full lookup
+struct AttributeSite
+{
+	static const int maxEntries = 4;
+	unsigned int epoch = 0;
+	int entries = 0;
+	string classNames[maxEntries];
+	boost::any* slots[maxEntries]; // nullptr if the class has no static value for it
+};
+
+// Sites are keyed by the access text, which stays the same for a line
+unordered_map<string, AttributeSite> attributeSites;
+
+// Finds the static value of an attribute in a class or its superclasses
+boost::any* FindStaticAttributeSlot(const string& className, const string& attributeName)
+{
+	auto classIt = globalClassDefinitions.find(className);
+	while (classIt != globalClassDefinitions.end())
+	{
+		auto it = classIt->second.staticAttributes.find(attributeName);
+		if (it != classIt->second.staticAttributes.end())
+			return &it->second;
+		if (classIt->second.superClassName.empty())
+			break;
+		classIt = globalClassDefinitions.find(classIt->second.superClassName);
+	}
+	return nullptr;
+}
+
+boost::any* CachedStaticAttributeSlot(AttributeSite& site, const string& className, const string& attributeName)
+{
+	if (site.epoch != classShapeEpoch)
+	{
+		site.epoch = classShapeEpoch;
+		site.entries = 0;
+	}
+	for (int i = 0; i < site.entries; i++)
+		if (site.classNames[i] == className)
+			return site.slots[i];
+
+	boost::any* slot = FindStaticAttributeSlot(className, attributeName);
+	if (site.entries < AttributeSite::maxEntries)
+	{
+		site.classNames[site.entries] = className;
+		site.slots[site.entries] = slot;
+		site.entries++;
+	}
+	return slot;
+}
+
+// GetClassAttribute through the cache of an access site
+boost::any GetClassAttribute(AttributeSite& site, const ClassInstance& instance, const string& attributeName)
+{
+	auto it = instance.instanceAttributes.find(attributeName);
+	if (it != instance.instanceAttributes.end())
+		return it->second;
+
+	boost::any* slot = CachedStaticAttributeSlot(site, instance.className, attributeName);
+	if (slot != nullptr)
+		return *slot;
+
+	LogWarning("Attribute '" + attributeName + "' not found in class '" + instance.className + "'");
+	return nullType;
+}
+
+// GetStaticAttribute through the cache of an access site
+boost::any GetStaticAttribute(AttributeSite& site, const string& className, const string& attributeName)
+{
+	boost::any* slot = CachedStaticAttributeSlot(site, className, attributeName);
+	if (slot != nullptr)
+		return *slot;
+
+	LogWarning("Static attribute '" + attributeName + "' not found in class '" + className + "'");
+	return nullType;
+}
+
 
 #endif
@@ -0,0 +1,301 @@
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/any.hpp>
+
+#include "strops.h"
+#include "main.h"
+
+int LogWarning(const string& warningText);
+
+using namespace std;
+
+// Conditions of if and while statements. A condition is made of comparisons
+// (a comparer b, or a lone value that must be true) joined with &&, || and !,
+// grouped with parenthesis:
+//     while i < n && !(Done(i) || x >= limit)
+// && binds tighter than ||, and 0 < i < 10 means 0 < i && i < 10. It is compiled once into a list of steps that
+// jump past the right side of && and || when the left side already decides
+// the result, so the skipped comparisons, and the calls in them, never run.
+
+struct ConditionStep
+{
+	enum Kind { Test, JumpIfFalse, JumpIfTrue, Not };
+	Kind kind;
+	string valA;     // Test: left side, or the lone value
+	string comparer; // Test: empty for a lone value
+	string valB;
+	int target = 0;  // Jumps: index of the step to continue from
+};
+
+class CompiledCondition
+{
+public:
+	// words are the words between the keyword and the '{'
+	explicit CompiledCondition(const vector<string>& words)
+	{
+		tokenize(words);
+		if (tokens.empty())
+			fail("empty condition");
+		else if (!parseOr() || pos != tokens.size())
+			fail("unexpected \'" + (pos < tokens.size() ? tokens.at(pos) : string("end")) + "\'");
+		tokens.clear();
+	}
+
+	bool valid() const { return error.empty(); }
+	const string& errorText() const { return error; }
+
+	bool evaluate(unordered_map<string, boost::any>& variableValues) const
+	{
+		bool result = false;
+		for (size_t i = 0; i < steps.size();)
+		{
+			const ConditionStep& step = steps[i];
+			switch (step.kind)
+			{
+			case ConditionStep::Test:
+				result = BooleanLogic(step.valA, step.comparer, step.valB, variableValues);
+				break;
+			case ConditionStep::Not:
+				result = !result;
+				break;
+			case ConditionStep::JumpIfFalse:
+				if (!result)
+				{
+					i = step.target;
+					continue;
+				}
+				break;
+			case ConditionStep::JumpIfTrue:
+				if (result)
+				{
+					i = step.target;
+					continue;
+				}
+				break;
+			}
+			i++;
+		}
+		return result;
+	}
+
+private:
+	vector<ConditionStep> steps;
+	vector<string> tokens; // Only used while compiling
+	size_t pos = 0;
+	string error;
+
+	static bool isComparer(const string& word)
+	{
+		return word == "==" || word == "!=" || word == "<" || word == ">" || word == "<=" || word == ">=";
+	}
+
+	bool fail(const string& text)
+	{
+		if (error.empty())
+			error = text;
+		return false;
+	}
+
+	// Splits '!' and grouping parenthesis off the words. Parenthesis that
+	// are balanced inside a word belong to its expression, like (a+1)*2. A
+	// string literal is kept whole in one token, even when it spans several
+	// words, so the operators and comparers in it are never read as such
+	void tokenize(const vector<string>& words)
+	{
+		vector<string> joined;
+		bool inQuotes = false;
+		for (const string& w : words)
+		{
+			string word = trim(w);
+			if (inQuotes)
+				joined.back() += " " + word;
+			else
+				joined.push_back(word);
+			for (size_t i = 0; i < word.size(); i++)
+				if (word[i] == '\"' && (i == 0 || word[i - 1] != '\\'))
+					inQuotes = !inQuotes;
+		}
+
+		for (string& word : joined)
+		{
+			while (word.size() > 1 && word[0] == '!' && word[1] != '=')
+			{
+				tokens.push_back("!");
+				word.erase(0, 1);
+			}
+			// Parenthesis inside a literal don't count
+			int depth = 0;
+			bool quoted = false;
+			for (size_t i = 0; i < word.size(); i++)
+			{
+				if (word[i] == '\"' && (i == 0 || word[i - 1] != '\\'))
+					quoted = !quoted;
+				else if (!quoted)
+					depth += word[i] == '(' ? 1 : word[i] == ')' ? -1 : 0;
+			}
+			while (depth > 0 && !word.empty() && word[0] == '(')
+			{
+				tokens.push_back("(");
+				word.erase(0, 1);
+				depth--;
+			}
+			int closing = 0;
+			while (depth < 0 && !word.empty() && word.back() == ')')
+			{
+				word.pop_back();
+				depth++;
+				closing++;
+			}
+			if (!word.empty())
+				tokens.push_back(word);
+			for (int i = 0; i < closing; i++)
+				tokens.push_back(")");
+		}
+	}
+
+	void emit(ConditionStep::Kind kind)
+	{
+		ConditionStep step;
+		step.kind = kind;
+		steps.push_back(step);
+	}
+
+	bool parseOr()
+	{
+		if (!parseAnd())
+			return false;
+		vector<size_t> jumps;
+		while (pos < tokens.size() && tokens[pos] == "||")
+		{
+			pos++;
+			jumps.push_back(steps.size());
+			emit(ConditionStep::JumpIfTrue);
+			if (!parseAnd())
+				return false;
+		}
+		for (size_t jump : jumps)
+			steps[jump].target = (int)steps.size();
+		return true;
+	}
+
+	bool parseAnd()
+	{
+		if (!parseUnary())
+			return false;
+		vector<size_t> jumps;
+		while (pos < tokens.size() && tokens[pos] == "&&")
+		{
+			pos++;
+			jumps.push_back(steps.size());
+			emit(ConditionStep::JumpIfFalse);
+			if (!parseUnary())
+				return false;
+		}
+		for (size_t jump : jumps)
+			steps[jump].target = (int)steps.size();
+		return true;
+	}
+
+	bool parseUnary()
+	{
+		if (pos < tokens.size() && tokens[pos] == "!")
+		{
+			pos++;
+			if (!parseUnary())
+				return false;
+			emit(ConditionStep::Not);
+			return true;
+		}
+		// A parenthesis either groups conditions or starts an expression,
+		// like (a + 1) * 2 == b. Tried as a group first
+		if (pos < tokens.size() && tokens[pos] == "(")
+		{
+			size_t start = pos;
+			size_t stepCount = steps.size();
+			pos++;
+			if (parseOr() && pos < tokens.size() && tokens[pos] == ")"
+				&& (pos + 1 == tokens.size() || tokens[pos + 1] == "&&" || tokens[pos + 1] == "||" || tokens[pos + 1] == ")"))
+			{
+				pos++;
+				return true;
+			}
+			pos = start;
+			steps.resize(stepCount);
+			error.clear();
+		}
+		return parseComparison();
+	}
+
+	// The words up to the next logical operator outside of parenthesis. Holy C
+	// range comparisons like 0 < i < 10 are chained with &&
+	bool parseComparison()
+	{
+		vector<vector<string>> values(1);
+		vector<string> comparers;
+		int depth = 0;
+		while (pos < tokens.size() && (depth > 0 || (tokens[pos] != "&&" && tokens[pos] != "||" && tokens[pos] != "!")))
+		{
+			if (tokens[pos] == "(")
+				depth++;
+			else if (tokens[pos] == ")" && --depth < 0)
+				break;
+			const string& token = tokens[pos++];
+			if (depth == 0 && isComparer(token))
+			{
+				comparers.push_back(token);
+				values.emplace_back();
+			}
+			else
+				values.back().push_back(token);
+		}
+		if (depth > 0)
+			return fail("missing \')\'");
+		for (const vector<string>& value : values)
+			if (value.empty())
+				return fail("missing value");
+
+		vector<size_t> jumps;
+		for (size_t i = 0; i < max(comparers.size(), (size_t)1); i++)
+		{
+			if (i > 0)
+			{
+				jumps.push_back(steps.size());
+				emit(ConditionStep::JumpIfFalse);
+			}
+			ConditionStep step;
+			step.kind = ConditionStep::Test;
+			step.valA = unWrapVec(values[i]);
+			if (!comparers.empty())
+			{
+				step.comparer = comparers[i];
+				step.valB = unWrapVec(values[i + 1]);
+			}
+			steps.push_back(step);
+		}
+		for (size_t jump : jumps)
+			steps[jump].target = (int)steps.size();
+		return true;
+	}
+};
+
+// Compiled conditions, by the text of their words
+unordered_map<string, CompiledCondition> compiledConditions;
+
+const CompiledCondition& GetCondition(const vector<string>& words)
+{
+	string key = unWrapVec(words);
+	auto found = compiledConditions.find(key);
+	if (found == compiledConditions.end())
+	{
+		found = compiledConditions.emplace(key, CompiledCondition(words)).first;
+		if (!found->second.valid())
+			LogWarning("invalid condition \'" + key + "\', " + found->second.errorText());
+	}
+	return found->second;
+}
+
+#endif
@@ -110,6 +110,10 @@ float evaluate(const string& t)
 			if (!ops.empty())
 				ops.pop();
 		}
+		// Anything else that isn't an operator, like the ';' ending a
+		// Holy C statement, is skipped
+		else if (precedence(tokens[i]) == 0)
+			continue;
 		// Current token is an operator.
 		else
 		{
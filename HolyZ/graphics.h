@@ -22,6 +22,9 @@
 #include <SDL_image.h>
 #include <string>
 #include <any>
+#include <thread>
+#include <memory>
+#include <filesystem>
 
 using namespace std;
 using namespace boost;
@@ -30,71 +33,6 @@ int WINDOW_WIDTH = 1280;
 int WINDOW_HEIGHT = 720;
 int PIXEL_SCALE = 1;
 
-unordered_map<string, int> KEYS =
-{
-	{"ESCAPE", 0},
-	{"1", 0},
-	{"2", 0},
-	{"3", 0},
-	{"4", 0},
-	{"5", 0},
-	{"6", 0},
-	{"7", 0},
-	{"8", 0},
-	{"9", 0},
-	{"TILDE", 0},
-	{"MINUS", 0},
-	{"EQUALS", 0},
-	{"BACKSPACE", 0},
-	{"TAB", 0},
-	{"Q", 0},
-	{"W", 0},
-	{"E", 0},
-	{"R", 0},
-	{"T", 0},
-	{"Y", 0},
-	{"U", 0},
-	{"I", 0},
-	{"O", 0},
-	{"P", 0},
-	{"BRACKET_L", 0},
-	{"BRACKET_R", 0},
-	{"BACKSLASH", 0},
-	{"A", 0},
-	{"S", 0},
-	{"D", 0},
-	{"F", 0},
-	{"G", 0},
-	{"H", 0},
-	{"J", 0},
-	{"K", 0},
-	{"L", 0},
-	{"COLON", 0},
-	{"QUOTE", 0},
-	{"ENTER", 0},
-	{"SHIFT_L", 0},
-	{"Z", 0},
-	{"X", 0},
-	{"C", 0},
-	{"V", 0},
-	{"B", 0},
-	{"N", 0},
-	{"M", 0},
-	{"COMMA", 0},
-	{"PERIOD", 0},
-	{"SLASH", 0},
-	{"SHIFT_R", 0},
-	{"CTRL_L", 0},
-	{"ALT_L", 0},
-	{"SPACE", 0},
-	{"ALT_R", 0},
-	{"CTRL_R", 0},
-	{"LEFT", 0},
-	{"UP", 0},
-	{"RIGHT", 0},
-	{"DOWN", 0}
-};
-
 enum Buttons
 {
 	PaddleOneUp = 0,
@@ -118,7 +56,87 @@ SDL_Surface* gScreenSurface = NULL;
 bool running = true;
 float dt = 0.0f;
 
+// Frame pacing, set by the script before ZS.Graphics.Init
+float FIXED_TIMESTEP = 0.0f; // Seconds per FixedUpdate tick, 0 runs no ticks
+int MAX_FIXED_STEPS = 8;     // Ticks per frame before the simulation falls behind
+float FRAME_LIMIT = 0.0f;    // Frames per second, 0 is unlimited
+bool VSYNC = false;
+
+// With --headless, the number of frames to run without a window, drawing
+// to an offscreen surface. 0 opens a window
+int HEADLESS_FRAMES = 0;
+// With --dump-frames, the directory headless frames are saved to as PNGs
+std::string FRAME_DUMP_DIR;
+
+// How far the simulation is between the last tick and the next one, from 0
+// to 1, for drawing positions between ticks
+float interpolationAlpha = 0.0f;
+
 float clamp(float v, float min, float max);
+int LogWarning(const string& warningText);
+int InterpreterLog(const string& logText);
+
+// Whether each key is down, indexed by SDL scancode. Kept up to date by SDL
+// while events are polled
+const Uint8* keyboardState = NULL;
+
+// Key names that don't match SDL's own name for the key. Any other name is
+// looked up with SDL_GetScancodeFromName, like "F1", "Keypad 5" or "Keypad_5"
+const unordered_map<string, SDL_Scancode> KEY_NAME_ALIASES =
+{
+	{"TILDE", SDL_SCANCODE_GRAVE},
+	{"MINUS", SDL_SCANCODE_MINUS},
+	{"EQUALS", SDL_SCANCODE_EQUALS},
+	{"BRACKET_L", SDL_SCANCODE_LEFTBRACKET},
+	{"BRACKET_R", SDL_SCANCODE_RIGHTBRACKET},
+	{"BACKSLASH", SDL_SCANCODE_BACKSLASH},
+	{"COLON", SDL_SCANCODE_SEMICOLON},
+	{"QUOTE", SDL_SCANCODE_APOSTROPHE},
+	{"ENTER", SDL_SCANCODE_RETURN},
+	{"SHIFT_L", SDL_SCANCODE_LSHIFT},
+	{"SHIFT_R", SDL_SCANCODE_RSHIFT},
+	{"CTRL_L", SDL_SCANCODE_LCTRL},
+	{"CTRL_R", SDL_SCANCODE_RCTRL},
+	{"ALT_L", SDL_SCANCODE_LALT},
+	{"ALT_R", SDL_SCANCODE_RALT},
+	{"COMMA", SDL_SCANCODE_COMMA},
+	{"PERIOD", SDL_SCANCODE_PERIOD},
+	{"SLASH", SDL_SCANCODE_SLASH},
+};
+
+// Scancodes of the key names used so far
+unordered_map<string, SDL_Scancode> keyNameScancodes;
+
+SDL_Scancode scancodeFromKeyName(const string& name)
+{
+	auto found = keyNameScancodes.find(name);
+	if (found != keyNameScancodes.end())
+		return found->second;
+
+	SDL_Scancode scancode;
+	auto alias = KEY_NAME_ALIASES.find(name);
+	if (alias != KEY_NAME_ALIASES.end())
+		scancode = alias->second;
+	else
+	{
+		scancode = SDL_GetScancodeFromName(name.c_str());
+		if (scancode == SDL_SCANCODE_UNKNOWN)
+		{
+			string spaced = name;
+			replace(spaced.begin(), spaced.end(), '_', ' ');
+			scancode = SDL_GetScancodeFromName(spaced.c_str());
+		}
+		if (scancode == SDL_SCANCODE_UNKNOWN)
+			LogWarning("unknown key name \'" + name + "\'");
+	}
+	keyNameScancodes[name] = scancode;
+	return scancode;
+}
+
+bool keyDown(int scancode)
+{
+	return keyboardState != NULL && scancode > SDL_SCANCODE_UNKNOWN && scancode < SDL_NUM_SCANCODES && keyboardState[scancode] != 0;
+}
 
 
 SDL_Surface* loadSurface(std::string path)
@@ -148,6 +166,209 @@ SDL_Surface* loadSurface(std::string path)
 	return optimizedSurface;
 }
 
+// A texture loaded from an image file. It is destroyed when the last Sprite
+// holding it is gone
+struct CachedTexture
+{
+	~CachedTexture()
+	{
+		if (texture != NULL)
+			SDL_DestroyTexture(texture);
+	}
+
+	SDL_Texture* texture = NULL;
+};
+
+// Textures of the images loaded so far, by canonical path, so Sprites of the
+// same image share one texture and the file is only decoded once
+unordered_map<string, std::weak_ptr<CachedTexture>> textureCache;
+
+// Every texture that is still alive, so they can be freed before the renderer
+vector<std::weak_ptr<CachedTexture>> liveTextures;
+
+string canonicalAssetPath(const string& path)
+{
+	std::error_code ec;
+	filesystem::path canonical = filesystem::weakly_canonical(path, ec);
+	if (ec)
+		return path;
+	return canonical.string();
+}
+
+std::shared_ptr<CachedTexture> acquireTexture(const string& path)
+{
+	string key = canonicalAssetPath(path);
+	auto found = textureCache.find(key);
+	if (found != textureCache.end())
+		if (std::shared_ptr<CachedTexture> cached = found->second.lock())
+			return cached;
+
+	std::shared_ptr<CachedTexture> cached = std::make_shared<CachedTexture>();
+	SDL_Surface* surface = loadSurface(path);
+	if (surface != NULL)
+	{
+		cached->texture = SDL_CreateTextureFromSurface(gRenderer, surface);
+		SDL_FreeSurface(surface);
+	}
+	textureCache[key] = cached;
+
+	// Forget the textures that were freed since the last load
+	liveTextures.erase(remove_if(liveTextures.begin(), liveTextures.end(),
+		[](const std::weak_ptr<CachedTexture>& t) { return t.expired(); }), liveTextures.end());
+	liveTextures.push_back(cached);
+	return cached;
+}
+
+// Decodes the image again, for when the file changed. Sprites still holding
+// the old texture keep it until they reload too
+std::shared_ptr<CachedTexture> reloadTexture(const string& path)
+{
+	textureCache.erase(canonicalAssetPath(path));
+	return acquireTexture(path);
+}
+
+// Destroys the cached textures while the renderer still exists. Sprites that
+// outlive it keep an empty texture
+void clearTextureCache()
+{
+	for (const std::weak_ptr<CachedTexture>& t : liveTextures)
+		if (std::shared_ptr<CachedTexture> cached = t.lock())
+		{
+			SDL_DestroyTexture(cached->texture);
+			cached->texture = NULL;
+		}
+	liveTextures.clear();
+	textureCache.clear();
+}
+
+// Fonts opened so far, by canonical path and point size. Every Text using a
+// font at a size shares it
+unordered_map<string, TTF_Font*> fontCache;
+
+TTF_Font* acquireFont(const string& path, int pointSize)
+{
+	string key = canonicalAssetPath(path) + "|" + to_string(pointSize);
+	auto found = fontCache.find(key);
+	if (found != fontCache.end())
+		return found->second;
+
+	TTF_Font* font = TTF_OpenFont(path.c_str(), pointSize);
+	if (font == NULL)
+		printf("Unable to load font %s! SDL_ttf Error: %s\n", path.c_str(), TTF_GetError());
+	fontCache[key] = font;
+	return font;
+}
+
+const int FIRST_ATLAS_GLYPH = 32;  // ' '
+const int LAST_ATLAS_GLYPH = 126;  // '~'
+
+// The printable ASCII glyphs of a font at one size, rasterized once in white
+// into a single texture. Text is drawn by copying glyphs out of it, tinted to
+// its color, so changing a Text's content or color never rasterizes again
+struct GlyphAtlas
+{
+	struct Glyph
+	{
+		SDL_Rect source{};
+		int advance = 0;
+	};
+
+	SDL_Texture* texture = NULL;
+	Glyph glyphs[LAST_ATLAS_GLYPH - FIRST_ATLAS_GLYPH + 1];
+	int height = 0;
+
+	// Characters outside of the atlas are drawn as '?'
+	const Glyph& glyph(char c) const
+	{
+		int index = (unsigned char)c;
+		if (index < FIRST_ATLAS_GLYPH || index > LAST_ATLAS_GLYPH)
+			index = '?';
+		return glyphs[index - FIRST_ATLAS_GLYPH];
+	}
+
+	int width(const string& content) const
+	{
+		int w = 0;
+		for (char c : content)
+			w += glyph(c).advance;
+		return w;
+	}
+};
+
+// Atlases by font, size and antialiasing
+unordered_map<string, GlyphAtlas> glyphAtlases;
+
+GlyphAtlas* acquireGlyphAtlas(const string& pathToFont, int pointSize, bool antialias)
+{
+	string key = canonicalAssetPath(pathToFont) + "|" + to_string(pointSize) + (antialias ? "|aa" : "");
+	auto found = glyphAtlases.find(key);
+	if (found != glyphAtlases.end())
+		return &found->second;
+
+	GlyphAtlas& atlas = glyphAtlases[key];
+	TTF_Font* font = acquireFont(pathToFont, pointSize);
+	if (font == NULL)
+		return &atlas;
+	atlas.height = TTF_FontHeight(font);
+
+	// Every glyph is rendered, then they are packed in rows no wider than the
+	// renderer's largest texture, as large fonts don't fit in a single row
+	SDL_RendererInfo info;
+	int maxWidth = SDL_GetRendererInfo(gRenderer, &info) == 0 && info.max_texture_width > 0 ? info.max_texture_width : numeric_limits<int>::max();
+	SDL_Color white = { 255, 255, 255, 255 };
+	vector<SDL_Surface*> rendered;
+	int atlasWidth = 0, rowX = 0, rowY = 0, rowHeight = 0;
+	for (int c = FIRST_ATLAS_GLYPH; c <= LAST_ATLAS_GLYPH; c++)
+	{
+		SDL_Surface* surface = antialias ? TTF_RenderGlyph_Blended(font, (Uint16)c, white) : TTF_RenderGlyph_Solid(font, (Uint16)c, white);
+		rendered.push_back(surface);
+
+		GlyphAtlas::Glyph& glyph = atlas.glyphs[c - FIRST_ATLAS_GLYPH];
+		TTF_GlyphMetrics(font, (Uint16)c, NULL, NULL, NULL, NULL, &glyph.advance);
+		if (surface != NULL)
+		{
+			if (rowX > 0 && surface->w > maxWidth - rowX)
+			{
+				rowY += rowHeight;
+				rowX = 0;
+				rowHeight = 0;
+			}
+			glyph.source = { rowX, rowY, surface->w, surface->h };
+			rowX += surface->w;
+			rowHeight = max(rowHeight, surface->h);
+			atlasWidth = max(atlasWidth, rowX);
+		}
+	}
+
+	SDL_Surface* sheet = SDL_CreateRGBSurfaceWithFormat(0, max(atlasWidth, 1), max(rowY + rowHeight, 1), 32, SDL_PIXELFORMAT_RGBA32);
+	for (int c = FIRST_ATLAS_GLYPH; c <= LAST_ATLAS_GLYPH; c++)
+	{
+		SDL_Surface* surface = rendered[c - FIRST_ATLAS_GLYPH];
+		if (surface == NULL)
+			continue;
+		// Copies the glyph's alpha instead of blending it onto the empty sheet
+		SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(surface, NULL, sheet, &atlas.glyphs[c - FIRST_ATLAS_GLYPH].source);
+		SDL_FreeSurface(surface);
+	}
+	atlas.texture = SDL_CreateTextureFromSurface(gRenderer, sheet);
+	SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+	SDL_FreeSurface(sheet);
+	return &atlas;
+}
+
+void clearFontCache()
+{
+	for (auto& atlas : glyphAtlases)
+		if (atlas.second.texture != NULL)
+			SDL_DestroyTexture(atlas.second.texture);
+	glyphAtlases.clear();
+	for (auto& font : fontCache)
+		if (font.second != NULL)
+			TTF_CloseFont(font.second);
+	fontCache.clear();
+}
+
 class Vec2
 {
 public:
@@ -356,6 +577,175 @@ int RotRectsCollision(_RotRect* rr1, _RotRect* rr2)
 		(ext1 > TR.y && ext2 > TR.y));
 }
 
+// A sprite waiting to be drawn at the end of the frame
+struct DrawCommand
+{
+	std::shared_ptr<CachedTexture> texture;
+	int layer;
+	SDL_Rect rect;      // In the world
+	SDL_FRect screen{}; // Through the camera, set when the queue is drawn
+};
+
+// Sprites drawn since the queue was last flushed
+vector<DrawCommand> renderQueue;
+
+// The view sprites are drawn through. position is the world point at the
+// center of the screen, and zoom scales the world around it. Without a
+// camera, world and screen coordinates are the same
+struct Camera
+{
+	Vec2 position;
+	float zoom = 1.0f;
+	bool enabled = false;
+
+	SDL_FRect toScreen(const SDL_Rect& rect) const
+	{
+		if (!enabled)
+			return { (float)rect.x, (float)rect.y, (float)rect.w, (float)rect.h };
+		return { (rect.x - position.x) * zoom + WINDOW_WIDTH / 2.0f, (rect.y - position.y) * zoom + WINDOW_HEIGHT / 2.0f, rect.w * zoom, rect.h * zoom };
+	}
+};
+
+Camera camera;
+
+// Draws the queued sprites, lowest layer first. Sprites entirely off the
+// screen are dropped first. Within a layer, sprites are drawn in the order
+// they were queued, so overlapping ones stack the same way every frame. Runs
+// of consecutive sprites with the same texture are drawn in one call
+void flushRenderQueue()
+{
+	if (renderQueue.empty())
+		return;
+
+	renderQueue.erase(remove_if(renderQueue.begin(), renderQueue.end(), [](DrawCommand& command) {
+		command.screen = camera.toScreen(command.rect);
+		const SDL_FRect& r = command.screen;
+		return r.x + r.w < 0 || r.y + r.h < 0 || r.x > WINDOW_WIDTH || r.y > WINDOW_HEIGHT;
+	}), renderQueue.end());
+
+	stable_sort(renderQueue.begin(), renderQueue.end(), [](const DrawCommand& a, const DrawCommand& b) {
+		return a.layer < b.layer;
+	});
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	static vector<SDL_Vertex> vertices;
+	static vector<int> indices;
+	SDL_Color white = { 255, 255, 255, 255 };
+	for (size_t start = 0; start < renderQueue.size();)
+	{
+		SDL_Texture* texture = renderQueue[start].texture->texture;
+		size_t end = start;
+		vertices.clear();
+		indices.clear();
+		while (end < renderQueue.size() && renderQueue[end].texture->texture == texture && renderQueue[end].layer == renderQueue[start].layer)
+		{
+			const SDL_FRect& r = renderQueue[end].screen;
+			int first = (int)vertices.size();
+			vertices.push_back({ { r.x, r.y }, white, { 0, 0 } });
+			vertices.push_back({ { r.x + r.w, r.y }, white, { 1, 0 } });
+			vertices.push_back({ { r.x + r.w, r.y + r.h }, white, { 1, 1 } });
+			vertices.push_back({ { r.x, r.y + r.h }, white, { 0, 1 } });
+			for (int i : { 0, 1, 2, 0, 2, 3 })
+				indices.push_back(first + i);
+			end++;
+		}
+		if (texture != NULL)
+			SDL_RenderGeometry(gRenderer, texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+		start = end;
+	}
+#else
+	for (const DrawCommand& command : renderQueue)
+	{
+		SDL_Rect r = { (int)floor(command.screen.x), (int)floor(command.screen.y), (int)ceil(command.screen.w), (int)ceil(command.screen.h) };
+		SDL_RenderCopy(gRenderer, command.texture->texture, NULL, &r);
+	}
+#endif
+	renderQueue.clear();
+}
+
+// Pixels drawn by the script. They are stored in memory, then uploaded to a
+// streaming texture in one go at the end of the frame and drawn over
+// everything else. Pixels last for the frame they were drawn in, like the
+// rest of the screen
+struct Framebuffer
+{
+	SDL_Texture* texture = NULL;
+	vector<Uint32> pixels;
+	int width = 0;
+	int height = 0;
+	bool drawn = false;
+
+	static Uint32 color(int r, int g, int b)
+	{
+		return 0xFF000000u | ((Uint32)(r & 255) << 16) | ((Uint32)(g & 255) << 8) | (Uint32)(b & 255);
+	}
+
+	// The texture is made on the first pixel, so scripts that never draw
+	// pixels don't upload anything
+	bool ready()
+	{
+		if (texture == NULL)
+		{
+			width = WINDOW_WIDTH;
+			height = WINDOW_HEIGHT;
+			texture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+			if (texture == NULL)
+				return false;
+			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+			pixels.assign((size_t)width * height, 0);
+		}
+		drawn = true;
+		return true;
+	}
+
+	void set(int x, int y, Uint32 c)
+	{
+		if (ready() && x >= 0 && y >= 0 && x < width && y < height)
+			pixels[(size_t)y * width + x] = c;
+	}
+
+	// Fills a rectangle, clipped to the screen. A span is a rectangle one
+	// pixel high
+	void fill(int x, int y, int w, int h, Uint32 c)
+	{
+		if (!ready())
+			return;
+		int x0 = max(x, 0), y0 = max(y, 0);
+		int x1 = min(x + w, width), y1 = min(y + h, height);
+		for (int row = y0; row < y1; row++)
+			std::fill(pixels.begin() + (size_t)row * width + x0, pixels.begin() + (size_t)row * width + max(x1, x0), c);
+	}
+
+	void present()
+	{
+		if (!drawn)
+			return;
+		void* locked;
+		int pitch;
+		if (SDL_LockTexture(texture, NULL, &locked, &pitch) == 0)
+		{
+			for (int row = 0; row < height; row++)
+				memcpy((Uint8*)locked + (size_t)row * pitch, &pixels[(size_t)row * width], (size_t)width * sizeof(Uint32));
+			SDL_UnlockTexture(texture);
+			SDL_Rect screen = { 0, 0, width, height };
+			SDL_RenderCopy(gRenderer, texture, NULL, &screen);
+		}
+		std::fill(pixels.begin(), pixels.end(), 0);
+		drawn = false;
+	}
+
+	void destroy()
+	{
+		if (texture != NULL)
+			SDL_DestroyTexture(texture);
+		texture = NULL;
+		pixels.clear();
+		drawn = false;
+	}
+};
+
+Framebuffer framebuffer;
+
 class Sprite
 {
 public:
@@ -373,31 +763,34 @@ public:
 		Load();
 	}
 
+	// Gets the texture of the image from the cache, which only reads the
+	// file the first time that image is used
 	int Load()
 	{
-		SDL_Surface* surface = loadSurface(path);
-		texture = SDL_CreateTextureFromSurface(gRenderer, surface);
-		SDL_FreeSurface(surface);
+		if (cachedTexture == nullptr)
+			cachedTexture = acquireTexture(path);
+		texture = cachedTexture->texture;
 		return 0;
 	}
 
+	// Reads the image file again, skipping the cache
 	int Update()
 	{
-		SDL_Surface* surface = loadSurface(path);
-		SDL_DestroyTexture(texture);
-		texture = SDL_CreateTextureFromSurface(gRenderer, surface);
-		SDL_FreeSurface(surface);
+		cachedTexture = reloadTexture(path);
+		texture = cachedTexture->texture;
 		return 0;
 	}
 
+	// Queues the sprite, it is drawn when the frame ends
 	int Draw()
 	{
-		SDL_RenderCopy(gRenderer, texture, NULL, &rect);
 		// Centers
 		rect.w = scale.x;
 		rect.h = scale.y;
 		rect.x = position.x - (rect.w / 2);
 		rect.y = position.y - (rect.h / 2);
+		if (cachedTexture != nullptr)
+			renderQueue.push_back({ cachedTexture, layer, rect });
 		return 0;
 	}
 
@@ -420,6 +813,8 @@ public:
 			return scale.x;
 		if (componentName == "scale.y")
 			return scale.y;
+		if (componentName == "layer")
+			return layer;
 		return 0;
 	}
 
@@ -505,6 +900,15 @@ public:
 			else if (oper == "/=")
 				scale.y /= AnyAsFloat(otherVal);
 		}
+		else if (componentName == "layer")
+		{
+			if (oper == "=")
+				layer = AnyAsInt(otherVal);
+			else if (oper == "+=")
+				layer += AnyAsInt(otherVal);
+			else if (oper == "-=")
+				layer -= AnyAsInt(otherVal);
+		}
 		// Centers
 		rect.w = scale.x;
 		rect.h = scale.y;
@@ -516,10 +920,12 @@ public:
 	Vec2 position;
 	Vec2 scale;
 	double angle;
+	int layer = 0;
 
 	std::string path;
 	SDL_Rect rect{};
-	SDL_Texture* texture;
+	SDL_Texture* texture = NULL;
+	std::shared_ptr<CachedTexture> cachedTexture;
 };
 
 class Text
@@ -531,50 +937,28 @@ public:
 		rect.x = position.x;
 		rect.y = position.y;
 
-		font = TTF_OpenFont(pathToFont.c_str(), fontSize);
-
 		Load();
 	}
 
 	int Load()
 	{
-		SDL_Color color = { r, g, b };
-
-		SDL_Surface* surface;
-		if (antialias)
-			surface = TTF_RenderText_Blended(font, content.c_str(), color);
-		else
-			surface = TTF_RenderText_Solid(font, content.c_str(), color);
-
-		texture = SDL_CreateTextureFromSurface(gRenderer, surface);
-
-		TTF_SizeText(font, content.c_str(), &rect.w, &rect.h);
-
-		scale.x = rect.w;
-		scale.y = rect.h;
-
-		// Centers
-		rect.x = position.x - (rect.w / 2);
-		rect.y = position.y - (rect.h / 2);
-
-		SDL_FreeSurface(surface);
-		return 0;
+		atlas = NULL;
+		return Update();
 	}
 
+	// Measures the content again. The glyphs are already in the atlas, so
+	// nothing is rasterized
 	int Update()
 	{
-		SDL_Color color = { r, g, b };
-
-		SDL_Surface* surface;
-		if (antialias)
-			surface = TTF_RenderText_Blended(font, content.c_str(), color);
-		else
-			surface = TTF_RenderText_Solid(font, content.c_str(), color);
-
-		SDL_DestroyTexture(texture);
-		texture = SDL_CreateTextureFromSurface(gRenderer, surface);
+		if (atlas == NULL || fontSize != atlasFontSize || antialias != atlasAntialias)
+		{
+			atlas = acquireGlyphAtlas(pathToFont, (int)fontSize, antialias);
+			atlasFontSize = fontSize;
+			atlasAntialias = antialias;
+		}
 
-		TTF_SizeText(font, content.c_str(), &rect.w, &rect.h);
+		rect.w = atlas->width(content);
+		rect.h = atlas->height;
 
 		scale.x = rect.w;
 		scale.y = rect.h;
@@ -582,14 +966,57 @@ public:
 		// Centers
 		rect.x = position.x - (rect.w / 2);
 		rect.y = position.y - (rect.h / 2);
-
-		SDL_FreeSurface(surface);
 		return 0;
 	}
 
+	// Copies each glyph out of the atlas, all in one draw call where the
+	// renderer supports geometry
 	int Draw()
 	{
-		SDL_RenderCopy(gRenderer, texture, NULL, &rect);
+		if (atlas == NULL || atlas->texture == NULL)
+			return 0;
+		// Text is drawn right away, over the sprites drawn before it
+		flushRenderQueue();
+		SDL_SetTextureColorMod(atlas->texture, r, g, b);
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		static vector<SDL_Vertex> vertices;
+		static vector<int> indices;
+		vertices.clear();
+		indices.clear();
+
+		int textureWidth = 1, textureHeight = 1;
+		SDL_QueryTexture(atlas->texture, NULL, NULL, &textureWidth, &textureHeight);
+		SDL_Color white = { 255, 255, 255, 255 };
+		float x = rect.x;
+		for (char c : content)
+		{
+			const GlyphAtlas::Glyph& glyph = atlas->glyph(c);
+			float u0 = (float)glyph.source.x / textureWidth, u1 = (float)(glyph.source.x + glyph.source.w) / textureWidth;
+			float v0 = (float)glyph.source.y / textureHeight, v1 = (float)(glyph.source.y + glyph.source.h) / textureHeight;
+			float y = rect.y;
+			int first = (int)vertices.size();
+			vertices.push_back({ { x, y }, white, { u0, v0 } });
+			vertices.push_back({ { x + glyph.source.w, y }, white, { u1, v0 } });
+			vertices.push_back({ { x + glyph.source.w, y + glyph.source.h }, white, { u1, v1 } });
+			vertices.push_back({ { x, y + glyph.source.h }, white, { u0, v1 } });
+			for (int i : { 0, 1, 2, 0, 2, 3 })
+				indices.push_back(first + i);
+			x += glyph.advance;
+		}
+		if (!vertices.empty())
+			SDL_RenderGeometry(gRenderer, atlas->texture, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+#else
+		SDL_Rect destination = { rect.x, rect.y, 0, 0 };
+		for (char c : content)
+		{
+			const GlyphAtlas::Glyph& glyph = atlas->glyph(c);
+			destination.w = glyph.source.w;
+			destination.h = glyph.source.h;
+			SDL_RenderCopy(gRenderer, atlas->texture, &glyph.source, &destination);
+			destination.x += glyph.advance;
+		}
+#endif
 		return 0;
 	}
 
@@ -746,18 +1173,27 @@ public:
 	std::string content;
 	std::string pathToFont;
 
-	TTF_Font* font;
+	GlyphAtlas* atlas = NULL;
+	float atlasFontSize = 0;
+	bool atlasAntialias = true;
 
 	std::string path;
 	SDL_Rect rect{};
-	SDL_Texture* texture;
 };
 
 int cleanupGraphics()
 {
 	// Cleanup
+	renderQueue.clear();
+	framebuffer.destroy();
+	clearTextureCache();
+	clearFontCache();
 	SDL_DestroyRenderer(gRenderer);
-	SDL_DestroyWindow(gWindow);
+	if (gWindow != NULL)
+		SDL_DestroyWindow(gWindow);
+	// The offscreen surface of a headless run belongs to us, unlike a window's
+	else
+		SDL_FreeSurface(gScreenSurface);
 	SDL_Quit();
 
 	return 0;
@@ -770,12 +1206,38 @@ int cleanupGraphics()
 //}
 
 
+// Sleeps until the time, coarsely first, then yields for the last
+// millisecond since the OS may oversleep by about that much
+void sleepUntil(std::chrono::steady_clock::time_point time)
+{
+	auto margin = std::chrono::milliseconds(1);
+	auto now = std::chrono::steady_clock::now();
+	if (time - now > margin)
+		std::this_thread::sleep_for(time - now - margin);
+	while (std::chrono::steady_clock::now() < time)
+		std::this_thread::yield();
+}
+
 int updateLoop()
 {
+	// FixedUpdate(step) runs at a constant rate when the script has it and
+	// a timestep was set, any number of times per frame
+	bool fixedTicks = FIXED_TIMESTEP > 0 && IsFunction("FixedUpdate");
+	double accumulator = 0;
+
+	// Headless frames take the same time each, one tick when ticks are on,
+	// so a run doesn't depend on how fast the machine is
+	bool headless = HEADLESS_FRAMES > 0;
+	float headlessDt = FIXED_TIMESTEP > 0 ? FIXED_TIMESTEP : 1.0f / 60.0f;
+	int frame = 0;
+	auto runStart = std::chrono::steady_clock::now();
+	if (headless)
+		dt = headlessDt;
+
 	// Continue looping and processing events until user exits
 	while (running)
 	{
-		auto startTime = std::chrono::high_resolution_clock::now();
+		auto startTime = std::chrono::steady_clock::now();
 
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
@@ -784,265 +1246,62 @@ int updateLoop()
 			{
 				running = false;
 			}
-			else if (event.type == SDL_KEYDOWN)
-			{
-				if (event.key.keysym.sym == SDLK_ESCAPE)
-					KEYS["ESCAPE"] = 1;
-				else if (event.key.keysym.sym == SDLK_0)
-					KEYS["0"] = 1;
-				else if (event.key.keysym.sym == SDLK_1)
-					KEYS["1"] = 1;
-				else if (event.key.keysym.sym == SDLK_2)
-					KEYS["2"] = 1;
-				else if (event.key.keysym.sym == SDLK_3)
-					KEYS["3"] = 1;
-				else if (event.key.keysym.sym == SDLK_4)
-					KEYS["4"] = 1;
-				else if (event.key.keysym.sym == SDLK_5)
-					KEYS["5"] = 1;
-				else if (event.key.keysym.sym == SDLK_6)
-					KEYS["6"] = 1;
-				else if (event.key.keysym.sym == SDLK_7)
-					KEYS["7"] = 1;
-				else if (event.key.keysym.sym == SDLK_8)
-					KEYS["8"] = 1;
-				else if (event.key.keysym.sym == SDLK_MINUS)
-					KEYS["MINUS"] = 1;
-				else if (event.key.keysym.sym == SDLK_EQUALS)
-					KEYS["EQUALS"] = 1;
-				else if (event.key.keysym.sym == SDLK_AC_BACK)
-					KEYS["BACKSPACE"] = 1;
-				else if (event.key.keysym.sym == SDLK_TAB)
-					KEYS["TAB"] = 1;
-				else if (event.key.keysym.sym == SDLK_q)
-					KEYS["Q"] = 1;
-				else if (event.key.keysym.sym == SDLK_w)
-					KEYS["W"] = 1;
-				else if (event.key.keysym.sym == SDLK_e)
-					KEYS["E"] = 1;
-				else if (event.key.keysym.sym == SDLK_r)
-					KEYS["R"] = 1;
-				else if (event.key.keysym.sym == SDLK_t)
-					KEYS["T"] = 1;
-				else if (event.key.keysym.sym == SDLK_y)
-					KEYS["Y"] = 1;
-				else if (event.key.keysym.sym == SDLK_u)
-					KEYS["U"] = 1;
-				else if (event.key.keysym.sym == SDLK_i)
-					KEYS["I"] = 1;
-				else if (event.key.keysym.sym == SDLK_o)
-					KEYS["O"] = 1;
-				else if (event.key.keysym.sym == SDLK_p)
-					KEYS["P"] = 1;
-				else if (event.key.keysym.sym == SDLK_LEFTBRACKET)
-					KEYS["BRACKET_L"] = 1;
-				else if (event.key.keysym.sym == SDLK_RIGHTBRACKET)
-					KEYS["BRACKET_R"] = 1;
-				else if (event.key.keysym.sym == SDLK_BACKSLASH)
-					KEYS["BACKSLASH"] = 1;
-				else if (event.key.keysym.sym == SDLK_a)
-					KEYS["A"] = 1;
-				else if (event.key.keysym.sym == SDLK_s)
-					KEYS["S"] = 1;
-				else if (event.key.keysym.sym == SDLK_d)
-					KEYS["D"] = 1;
-				else if (event.key.keysym.sym == SDLK_f)
-					KEYS["F"] = 1;
-				else if (event.key.keysym.sym == SDLK_g)
-					KEYS["G"] = 1;
-				else if (event.key.keysym.sym == SDLK_h)
-					KEYS["H"] = 1;
-				else if (event.key.keysym.sym == SDLK_j)
-					KEYS["J"] = 1;
-				else if (event.key.keysym.sym == SDLK_k)
-					KEYS["K"] = 1;
-				else if (event.key.keysym.sym == SDLK_l)
-					KEYS["L"] = 1;
-				else if (event.key.keysym.sym == SDLK_COLON)
-					KEYS["COLON"] = 1;
-				else if (event.key.keysym.sym == SDLK_QUOTE)
-					KEYS["QUOTE"] = 1;
-				else if (event.key.keysym.sym == SDLK_RETURN)
-					KEYS["ENTER"] = 1;
-				else if (event.key.keysym.sym == SDLK_LSHIFT)
-					KEYS["SHIFT_L"] = 1;
-				else if (event.key.keysym.sym == SDLK_z)
-					KEYS["Z"] = 1;
-				else if (event.key.keysym.sym == SDLK_x)
-					KEYS["X"] = 1;
-				else if (event.key.keysym.sym == SDLK_c)
-					KEYS["C"] = 1;
-				else if (event.key.keysym.sym == SDLK_v)
-					KEYS["V"] = 1;
-				else if (event.key.keysym.sym == SDLK_b)
-					KEYS["B"] = 1;
-				else if (event.key.keysym.sym == SDLK_n)
-					KEYS["N"] = 1;
-				else if (event.key.keysym.sym == SDLK_m)
-					KEYS["M"] = 1;
-				else if (event.key.keysym.sym == SDLK_COMMA)
-					KEYS["COMMA"] = 1;
-				else if (event.key.keysym.sym == SDLK_PERIOD)
-					KEYS["PERIOD"] = 1;
-				else if (event.key.keysym.sym == SDLK_SLASH)
-					KEYS["SLASH"] = 1;
-				else if (event.key.keysym.sym == SDLK_RSHIFT)
-					KEYS["SHIFT_R"] = 1;
-				else if (event.key.keysym.sym == SDLK_LCTRL)
-					KEYS["CTRL_L"] = 1;
-				else if (event.key.keysym.sym == SDLK_LALT)
-					KEYS["ALT_L"] = 1;
-				else if (event.key.keysym.sym == SDLK_SPACE)
-					KEYS["SPACE"] = 1;
-				else if (event.key.keysym.sym == SDLK_RALT)
-					KEYS["ALT_R"] = 1;
-				else if (event.key.keysym.sym == SDLK_RCTRL)
-					KEYS["CTRL_R"] = 1;
-				else if (event.key.keysym.sym == SDLK_LEFT)
-					KEYS["LEFT"] = 1;
-				else if (event.key.keysym.sym == SDLK_UP)
-					KEYS["UP"] = 1;
-				else if (event.key.keysym.sym == SDLK_RIGHT)
-					KEYS["RIGHT"] = 1;
-				else if (event.key.keysym.sym == SDLK_DOWN)
-					KEYS["DOWN"] = 1;
-			}
-			else if (event.type == SDL_KEYUP)
+		}
+
+		if (fixedTicks)
+		{
+			accumulator += dt;
+			int steps = 0;
+			while (accumulator >= FIXED_TIMESTEP && steps < MAX_FIXED_STEPS)
 			{
-				if (event.key.keysym.sym == SDLK_ESCAPE)
-					KEYS["ESCAPE"] = 0;
-				else if (event.key.keysym.sym == SDLK_0)
-					KEYS["0"] = 0;
-				else if (event.key.keysym.sym == SDLK_1)
-					KEYS["1"] = 0;
-				else if (event.key.keysym.sym == SDLK_2)
-					KEYS["2"] = 0;
-				else if (event.key.keysym.sym == SDLK_3)
-					KEYS["3"] = 0;
-				else if (event.key.keysym.sym == SDLK_4)
-					KEYS["4"] = 0;
-				else if (event.key.keysym.sym == SDLK_5)
-					KEYS["5"] = 0;
-				else if (event.key.keysym.sym == SDLK_6)
-					KEYS["6"] = 0;
-				else if (event.key.keysym.sym == SDLK_7)
-					KEYS["7"] = 0;
-				else if (event.key.keysym.sym == SDLK_8)
-					KEYS["8"] = 0;
-				else if (event.key.keysym.sym == SDLK_MINUS)
-					KEYS["MINUS"] = 0;
-				else if (event.key.keysym.sym == SDLK_EQUALS)
-					KEYS["EQUALS"] = 0;
-				else if (event.key.keysym.sym == SDLK_AC_BACK)
-					KEYS["BACKSPACE"] = 0;
-				else if (event.key.keysym.sym == SDLK_TAB)
-					KEYS["TAB"] = 0;
-				else if (event.key.keysym.sym == SDLK_q)
-					KEYS["Q"] = 0;
-				else if (event.key.keysym.sym == SDLK_w)
-					KEYS["W"] = 0;
-				else if (event.key.keysym.sym == SDLK_e)
-					KEYS["E"] = 0;
-				else if (event.key.keysym.sym == SDLK_r)
-					KEYS["R"] = 0;
-				else if (event.key.keysym.sym == SDLK_t)
-					KEYS["T"] = 0;
-				else if (event.key.keysym.sym == SDLK_y)
-					KEYS["Y"] = 0;
-				else if (event.key.keysym.sym == SDLK_u)
-					KEYS["U"] = 0;
-				else if (event.key.keysym.sym == SDLK_i)
-					KEYS["I"] = 0;
-				else if (event.key.keysym.sym == SDLK_o)
-					KEYS["O"] = 0;
-				else if (event.key.keysym.sym == SDLK_p)
-					KEYS["P"] = 0;
-				else if (event.key.keysym.sym == SDLK_LEFTBRACKET)
-					KEYS["BRACKET_L"] = 0;
-				else if (event.key.keysym.sym == SDLK_RIGHTBRACKET)
-					KEYS["BRACKET_R"] = 0;
-				else if (event.key.keysym.sym == SDLK_BACKSLASH)
-					KEYS["BACKSLASH"] = 0;
-				else if (event.key.keysym.sym == SDLK_a)
-					KEYS["A"] = 0;
-				else if (event.key.keysym.sym == SDLK_s)
-					KEYS["S"] = 0;
-				else if (event.key.keysym.sym == SDLK_d)
-					KEYS["D"] = 0;
-				else if (event.key.keysym.sym == SDLK_f)
-					KEYS["F"] = 0;
-				else if (event.key.keysym.sym == SDLK_g)
-					KEYS["G"] = 0;
-				else if (event.key.keysym.sym == SDLK_h)
-					KEYS["H"] = 0;
-				else if (event.key.keysym.sym == SDLK_j)
-					KEYS["J"] = 0;
-				else if (event.key.keysym.sym == SDLK_k)
-					KEYS["K"] = 0;
-				else if (event.key.keysym.sym == SDLK_l)
-					KEYS["L"] = 0;
-				else if (event.key.keysym.sym == SDLK_COLON)
-					KEYS["COLON"] = 0;
-				else if (event.key.keysym.sym == SDLK_QUOTE)
-					KEYS["QUOTE"] = 0;
-				else if (event.key.keysym.sym == SDLK_RETURN)
-					KEYS["ENTER"] = 0;
-				else if (event.key.keysym.sym == SDLK_LSHIFT)
-					KEYS["SHIFT_L"] = 0;
-				else if (event.key.keysym.sym == SDLK_z)
-					KEYS["Z"] = 0;
-				else if (event.key.keysym.sym == SDLK_x)
-					KEYS["X"] = 0;
-				else if (event.key.keysym.sym == SDLK_c)
-					KEYS["C"] = 0;
-				else if (event.key.keysym.sym == SDLK_v)
-					KEYS["V"] = 0;
-				else if (event.key.keysym.sym == SDLK_b)
-					KEYS["B"] = 0;
-				else if (event.key.keysym.sym == SDLK_n)
-					KEYS["N"] = 0;
-				else if (event.key.keysym.sym == SDLK_m)
-					KEYS["M"] = 0;
-				else if (event.key.keysym.sym == SDLK_COMMA)
-					KEYS["COMMA"] = 0;
-				else if (event.key.keysym.sym == SDLK_PERIOD)
-					KEYS["PERIOD"] = 0;
-				else if (event.key.keysym.sym == SDLK_SLASH)
-					KEYS["SLASH"] = 0;
-				else if (event.key.keysym.sym == SDLK_RSHIFT)
-					KEYS["SHIFT_R"] = 0;
-				else if (event.key.keysym.sym == SDLK_LCTRL)
-					KEYS["CTRL_L"] = 0;
-				else if (event.key.keysym.sym == SDLK_LALT)
-					KEYS["ALT_L"] = 0;
-				else if (event.key.keysym.sym == SDLK_SPACE)
-					KEYS["SPACE"] = 0;
-				else if (event.key.keysym.sym == SDLK_RALT)
-					KEYS["ALT_R"] = 0;
-				else if (event.key.keysym.sym == SDLK_RCTRL)
-					KEYS["CTRL_R"] = 0;
-				else if (event.key.keysym.sym == SDLK_LEFT)
-					KEYS["LEFT"] = 0;
-				else if (event.key.keysym.sym == SDLK_UP)
-					KEYS["UP"] = 0;
-				else if (event.key.keysym.sym == SDLK_RIGHT)
-					KEYS["RIGHT"] = 0;
-				else if (event.key.keysym.sym == SDLK_DOWN)
-					KEYS["DOWN"] = 0;
+				ExecuteFunction("FixedUpdate", vector<boost::any> {FIXED_TIMESTEP});
+				accumulator -= FIXED_TIMESTEP;
+				steps++;
 			}
+			// Too far behind to catch up, the rest of the backlog is dropped
+			if (steps == MAX_FIXED_STEPS)
+				accumulator = fmod(accumulator, FIXED_TIMESTEP);
+			interpolationAlpha = (float)(accumulator / FIXED_TIMESTEP);
 		}
 
 		SDL_RenderClear(gRenderer);
 
 		ExecuteFunction("Update", vector<boost::any> {dt});
+		flushRenderQueue();
+		framebuffer.present();
 
 		// Present the backbuffer
 		SDL_RenderPresent(gRenderer);
 
-		// Calculate frame time
-		auto stopTime = std::chrono::high_resolution_clock::now();
-		dt = std::chrono::duration<float, std::chrono::milliseconds::period>(stopTime - startTime).count() / 1000.0f;
-		dt = clamp(dt, 0, 1000);
+		if (headless)
+		{
+			frame++;
+			if (!FRAME_DUMP_DIR.empty())
+			{
+				char fileName[32];
+				snprintf(fileName, sizeof(fileName), "frame_%05d.png", frame);
+				if (IMG_SavePNG(gScreenSurface, (FRAME_DUMP_DIR + "/" + fileName).c_str()) != 0)
+					printf("Unable to save frame %d! SDL_image Error: %s\n", frame, IMG_GetError());
+			}
+			if (frame >= HEADLESS_FRAMES)
+				running = false;
+			continue;
+		}
+
+		if (FRAME_LIMIT > 0)
+			sleepUntil(startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / FRAME_LIMIT)));
+
+		// Calculate frame time. A long stall, like dragging the window, counts
+		// as a quarter of a second at most
+		auto stopTime = std::chrono::steady_clock::now();
+		dt = std::chrono::duration<float>(stopTime - startTime).count();
+		dt = clamp(dt, 0, 0.25f);
+	}
+
+	if (headless)
+	{
+		float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - runStart).count();
+		InterpreterLog("Ran " + to_string(frame) + " headless frames in " + to_string(seconds) + "s");
 	}
 	return 0;
 }
@@ -1053,18 +1312,40 @@ int initGraphics(std::string windowTitle, int width, int height, int pixelScale)
 	WINDOW_HEIGHT = height;
 	PIXEL_SCALE = pixelScale;
 
-	// Initialize SDL components
-	SDL_Init(SDL_INIT_VIDEO);
-	TTF_Init();
+	if (HEADLESS_FRAMES > 0)
+	{
+		// No display is needed, the software renderer draws into a surface
+		SDL_Init(SDL_INIT_EVENTS);
+		TTF_Init();
 
-	gWindow = SDL_CreateWindow(windowTitle.c_str(), 40, 40, WINDOW_WIDTH * PIXEL_SCALE, WINDOW_HEIGHT * PIXEL_SCALE, SDL_WINDOW_SHOWN | SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-	gRenderer = SDL_CreateRenderer(gWindow, -1, 0);
+		gScreenSurface = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH * PIXEL_SCALE, WINDOW_HEIGHT * PIXEL_SCALE, 32, SDL_PIXELFORMAT_ARGB8888);
+		gRenderer = SDL_CreateSoftwareRenderer(gScreenSurface);
+	}
+	else
+	{
+		// Initialize SDL components
+		SDL_Init(SDL_INIT_VIDEO);
+		TTF_Init();
+
+		gWindow = SDL_CreateWindow(windowTitle.c_str(), 40, 40, WINDOW_WIDTH * PIXEL_SCALE, WINDOW_HEIGHT * PIXEL_SCALE, SDL_WINDOW_SHOWN);
+		gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED | (VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0));
+		// No accelerated renderer, any renderer SDL has will do
+		if (gRenderer == NULL)
+			gRenderer = SDL_CreateRenderer(gWindow, -1, VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0);
+
+		//Get window surface
+		gScreenSurface = SDL_GetWindowSurface(gWindow);
+	}
+	if (gRenderer == NULL)
+	{
+		printf("Unable to create renderer! SDL Error: %s\n", SDL_GetError());
+		return 1;
+	}
 	SDL_RenderSetLogicalSize(gRenderer, WINDOW_WIDTH * PIXEL_SCALE, WINDOW_HEIGHT * PIXEL_SCALE);
 	SDL_RenderSetScale(gRenderer, PIXEL_SCALE, PIXEL_SCALE);
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, 0);
 
-	//Get window surface
-	gScreenSurface = SDL_GetWindowSurface(gWindow);
+	keyboardState = SDL_GetKeyboardState(NULL);
 
 	ExecuteFunction("Start", vector<boost::any> {});
 
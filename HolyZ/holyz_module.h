@@ -0,0 +1,165 @@
+#ifndef HOLYZ_MODULE_H
+#define HOLYZ_MODULE_H
+
+/*
+ * C ABI for native extension modules.
+ *
+ * A module is a shared library exporting holyz_module_init. When a script
+ * calls ZS.System.LoadModule("path"), the interpreter opens the library and
+ * calls holyz_module_init once, which registers the module's functions.
+ * A function registered as "Hash.Fnv1a" is called from scripts as
+ * ZS.Hash.Fnv1a(...).
+ *
+ * Arguments are passed as HolyZValue, without converting numbers to text.
+ * The interpreter keeps number literals as text ("int x = 5" holds "5"), so
+ * text that reads as a number is passed as HOLYZ_INT, or HOLYZ_FLOAT when it
+ * has a decimal point or is out of int range. This includes a string variable
+ * holding only digits. A quoted literal ("123") stays a HOLYZ_STRING.
+ * String arguments point into the interpreter's memory and are only valid
+ * during the call. A returned string must stay valid until the function
+ * returns to the interpreter, which copies it.
+ *
+ *     #include "holyz_module.h"
+ *
+ *     static HolyZValue Twice(const HolyZValue* args, size_t argCount)
+ *     {
+ *         return holyz_float((float)(holyz_to_double(&args[0]) * 2));
+ *     }
+ *
+ *     HOLYZ_MODULE_EXPORT int holyz_module_init(HolyZRegistry* registry)
+ *     {
+ *         return registry->registerFunction(registry, "Demo.Twice", Twice, 1);
+ *     }
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOLYZ_MODULE_ABI_VERSION 1
+#define HOLYZ_MODULE_INIT_NAME "holyz_module_init"
+
+#if defined(_WIN32)
+#define HOLYZ_MODULE_EXPORT __declspec(dllexport)
+#else
+#define HOLYZ_MODULE_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+#undef HOLYZ_MODULE_EXPORT
+#if defined(_WIN32)
+#define HOLYZ_MODULE_EXPORT extern "C" __declspec(dllexport)
+#else
+#define HOLYZ_MODULE_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+extern "C" {
+#endif
+
+typedef enum HolyZType
+{
+	HOLYZ_NULL = 0,
+	HOLYZ_INT = 1,
+	HOLYZ_FLOAT = 2,
+	HOLYZ_BOOL = 3,
+	HOLYZ_STRING = 4
+} HolyZType;
+
+typedef struct HolyZValue
+{
+	HolyZType type;
+	union
+	{
+		int i;
+		float f;
+		int b;
+		struct
+		{
+			const char* data;
+			size_t length;
+		} s;
+	} as;
+} HolyZValue;
+
+typedef HolyZValue (*HolyZFunction)(const HolyZValue* args, size_t argCount);
+
+typedef struct HolyZRegistry
+{
+	int abiVersion;
+	/* Returns 0 if the name is empty or already taken. A paramCount of -1
+	   accepts any number of arguments */
+	int (*registerFunction)(struct HolyZRegistry* registry, const char* name, HolyZFunction function, int paramCount);
+	void* host;
+} HolyZRegistry;
+
+/* Exported by the module. Returning 0 refuses the load */
+typedef int (*HolyZModuleInit)(HolyZRegistry* registry);
+
+static inline HolyZValue holyz_null(void)
+{
+	HolyZValue value;
+	value.type = HOLYZ_NULL;
+	value.as.i = 0;
+	return value;
+}
+
+static inline HolyZValue holyz_int(int i)
+{
+	HolyZValue value;
+	value.type = HOLYZ_INT;
+	value.as.i = i;
+	return value;
+}
+
+static inline HolyZValue holyz_float(float f)
+{
+	HolyZValue value;
+	value.type = HOLYZ_FLOAT;
+	value.as.f = f;
+	return value;
+}
+
+static inline HolyZValue holyz_bool(int b)
+{
+	HolyZValue value;
+	value.type = HOLYZ_BOOL;
+	value.as.b = b != 0;
+	return value;
+}
+
+static inline HolyZValue holyz_string(const char* data, size_t length)
+{
+	HolyZValue value;
+	value.type = HOLYZ_STRING;
+	value.as.s.data = data;
+	value.as.s.length = length;
+	return value;
+}
+
+/* Strings are parsed too, for values a module builds itself */
+static inline double holyz_to_double(const HolyZValue* value)
+{
+	char buffer[64];
+	switch (value->type)
+	{
+	case HOLYZ_INT:
+		return value->as.i;
+	case HOLYZ_FLOAT:
+		return value->as.f;
+	case HOLYZ_BOOL:
+		return value->as.b;
+	case HOLYZ_STRING:
+		if (value->as.s.length == 0 || value->as.s.length >= sizeof(buffer))
+			return 0;
+		memcpy(buffer, value->as.s.data, value->as.s.length);
+		buffer[value->as.s.length] = '\0';
+		return strtod(buffer, NULL);
+	default:
+		return 0;
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,442 @@
+// jit.cpp - Native code generation for hot numeric while loops
+
+#include "jit.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(HOLYZ_JIT_ENABLED) && defined(__x86_64__) && defined(__linux__)
+#define JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace Jit {
+#if JIT_X64
+	bool isSupported() {
+		return true;
+	}
+
+	// Expression tree. Leaves load a slot, inner nodes apply + - * /
+	struct Node {
+		char op = 0; // 0 for a slot load
+		int slot = 0;
+		unique_ptr<Node> left;
+		unique_ptr<Node> right;
+	};
+
+	static unique_ptr<Node> leaf(int slot) {
+		unique_ptr<Node> node(new Node());
+		node->slot = slot;
+		return node;
+	}
+
+	static unique_ptr<Node> binary(char op, unique_ptr<Node> left, unique_ptr<Node> right) {
+		unique_ptr<Node> node(new Node());
+		node->op = op;
+		node->left = move(left);
+		node->right = move(right);
+		return node;
+	}
+
+	// Slots of the loop: variables first, then the constants
+	struct SlotTable {
+		vector<string> names;
+		vector<bool> assigned;
+		vector<float> constants;
+
+		int variable(const string& name) {
+			auto it = find(names.begin(), names.end(), name);
+			if (it != names.end())
+				return (int)(it - names.begin());
+			names.push_back(name);
+			assigned.push_back(false);
+			return (int)names.size() - 1;
+		}
+
+		// Constant slots are numbered from -1 down until the layout is final
+		int constant(float value) {
+			for (size_t i = 0; i < constants.size(); i++)
+				if (memcmp(&constants[i], &value, sizeof(float)) == 0)
+					return -1 - (int)i;
+			constants.push_back(value);
+			return -(int)constants.size();
+		}
+	};
+
+	// Parses the arithmetic evaluate() understands. Forms where evaluate()
+	// disagrees with ordinary arithmetic are rejected: '^', a '-' following ')'
+	// and a unary minus on anything but a number literal. Names are scanned
+	// the way EvalExpression scans them
+	class ExpressionParser {
+	public:
+		ExpressionParser(const string& expression, SlotTable& slots) : slots(slots) {
+			for (char c : expression)
+				if (c != ' ')
+					text += c;
+		}
+
+		unique_ptr<Node> parse() {
+			unique_ptr<Node> node = sum();
+			if (!node || pos != text.size())
+				return nullptr;
+			return node;
+		}
+
+	private:
+		unique_ptr<Node> sum() {
+			unique_ptr<Node> node = product();
+			while (node && pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+				if (text[pos] == '-' && pos > 0 && text[pos - 1] == ')')
+					return nullptr;
+				char op = text[pos++];
+				unique_ptr<Node> right = product();
+				if (!right)
+					return nullptr;
+				node = binary(op, move(node), move(right));
+			}
+			return node;
+		}
+
+		unique_ptr<Node> product() {
+			unique_ptr<Node> node = primary();
+			while (node && pos < text.size() && (text[pos] == '*' || text[pos] == '/')) {
+				char op = text[pos++];
+				unique_ptr<Node> right = primary();
+				if (!right)
+					return nullptr;
+				node = binary(op, move(node), move(right));
+			}
+			return node;
+		}
+
+		unique_ptr<Node> primary() {
+			if (pos >= text.size())
+				return nullptr;
+			char c = text[pos];
+			if (c == '(') {
+				pos++;
+				unique_ptr<Node> node = sum();
+				if (!node || pos >= text.size() || text[pos] != ')')
+					return nullptr;
+				pos++;
+				return node;
+			}
+			if (c == '-' && pos + 1 < text.size() && isdigit((unsigned char)text[pos + 1])) {
+				pos++;
+				return number(true);
+			}
+			if (isdigit((unsigned char)c))
+				return number(false);
+			if (isalpha((unsigned char)c) || c == '_') {
+				string name;
+				while (pos < text.size() && (isalpha((unsigned char)text[pos]) || text[pos] == '_'))
+					name += text[pos++];
+				if (pos < text.size() && (isdigit((unsigned char)text[pos]) || text[pos] == '.' || text[pos] == '('))
+					return nullptr;
+				return leaf(slots.variable(name));
+			}
+			return nullptr;
+		}
+
+		unique_ptr<Node> number(bool negative) {
+			size_t start = pos;
+			int dots = 0;
+			while (pos < text.size() && (isdigit((unsigned char)text[pos]) || text[pos] == '.')) {
+				if (text[pos] == '.')
+					dots++;
+				pos++;
+			}
+			if (dots > 1)
+				return nullptr;
+			float value = strtof(text.substr(start, pos - start).c_str(), nullptr);
+			return leaf(slots.constant(negative ? -value : value));
+		}
+
+		string text;
+		size_t pos = 0;
+		SlotTable& slots;
+	};
+
+	// "target op value", with op '=' for plain assignments and declarations
+	struct Assignment {
+		int slot;
+		char op;
+		string operand; // The text of value, without spaces
+		unique_ptr<Node> value;
+	};
+
+	static bool hasOperator(const string& expression) {
+		return expression.find_first_of("+-*/^") != string::npos;
+	}
+
+	static bool isName(const string& text) {
+		return !text.empty() && text.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_") == string::npos;
+	}
+
+	static string join(const vector<string>& words, size_t start) {
+		string joined;
+		for (size_t i = start; i < words.size(); i++)
+			joined += (i > start ? " " : "") + words[i];
+		return joined;
+	}
+
+	// Turns one body line into an assignment, the way varOperation and
+	// declarations in ProcessLine evaluate it
+	static bool parseStatement(const vector<string>& line, const vector<string>& typeNames, SlotTable& slots, vector<Assignment>& statements) {
+		if (line.size() == 1 && line[0] == "{")
+			return true;
+
+		string target, op, expression;
+		if (line.size() >= 4 && find(typeNames.begin(), typeNames.end(), line[0]) != typeNames.end() && line[2] == "=") {
+			target = line[1];
+			op = "=";
+			expression = join(line, 3);
+		}
+		else if (line.size() >= 3 && (line[1] == "=" || line[1] == "+=" || line[1] == "-=" || line[1] == "*=" || line[1] == "/=")) {
+			target = line[0];
+			op = line[1];
+			expression = join(line, 2);
+		}
+		else
+			return false;
+
+		// A plain "=" without arithmetic copies the value with its type
+		// instead of producing a float
+		if (op == "=" && !hasOperator(expression))
+			return false;
+		if (!isName(target))
+			return false;
+
+		unique_ptr<Node> value = ExpressionParser(expression, slots).parse();
+		if (!value)
+			return false;
+		int slot = slots.variable(target);
+		slots.assigned[slot] = true;
+		string operand;
+		for (char c : expression)
+			if (c != ' ')
+				operand += c;
+		statements.push_back({ slot, op[0], operand, move(value) });
+		return true;
+	}
+
+	// Just the instructions the loops need: SSE on xmm0-xmm7 for conditions,
+	// eax, ecx and edx for the body. rdi holds the slot array
+	class Assembler {
+	public:
+		vector<unsigned char> code;
+
+		void loadSlot(int reg, int offset) {
+			emit({ 0xF3, 0x0F, 0x10, (unsigned char)(0x80 | (reg << 3) | 7) });
+			emit32(offset);
+		}
+
+		// cvtsi2ss, an int slot read as a float
+		void convertSlot(int reg, int offset) {
+			emit({ 0xF3, 0x0F, 0x2A, (unsigned char)(0x80 | (reg << 3) | 7) });
+			emit32(offset);
+		}
+
+		void loadInt(int offset) {
+			emit({ 0x8B, 0x87 });
+			emit32(offset);
+		}
+
+		void storeInt(int offset) {
+			emit({ 0x89, 0x87 });
+			emit32(offset);
+		}
+
+		// eax op= int slot, for + - *. Wraps around like the interpreter
+		void intSlotArithmetic(char op, int offset) {
+			if (op == '+')
+				emit({ 0x03, 0x87 });
+			else if (op == '-')
+				emit({ 0x2B, 0x87 });
+			else
+				emit({ 0x0F, 0xAF, 0x87 });
+			emit32(offset);
+		}
+
+		// eax op= value. / truncates, value must not be 0
+		void intConstantArithmetic(char op, int value) {
+			if (op == '+')
+				emit({ 0x05 });
+			else if (op == '-')
+				emit({ 0x2D });
+			else if (op == '*')
+				emit({ 0x69, 0xC0 });
+			else
+				emit({ 0xB9 }); // mov ecx, value
+			emit32(value);
+			if (op == '/')
+				emit({ 0x99, 0xF7, 0xF9 }); // cdq, idiv ecx
+		}
+
+		void arithmetic(char op, int dst, int src) {
+			unsigned char opcode = op == '+' ? 0x58 : op == '-' ? 0x5C : op == '*' ? 0x59 : 0x5E;
+			emit({ 0xF3, 0x0F, opcode, (unsigned char)(0xC0 | (dst << 3) | src) });
+		}
+
+		// ucomiss a, b
+		void compare(int a, int b) {
+			emit({ 0x0F, 0x2E, (unsigned char)(0xC0 | (a << 3) | b) });
+		}
+
+		// Conditional near jump back to target, condition code 0x7 ja or 0x3 jae
+		void jumpBack(unsigned char conditionCode, size_t target) {
+			emit({ 0x0F, (unsigned char)(0x80 | conditionCode) });
+			emit32((int)((long long)target - (long long)(code.size() + 4)));
+		}
+
+		void ret() {
+			code.push_back(0xC3);
+		}
+
+	private:
+		void emit(initializer_list<unsigned char> bytes) {
+			code.insert(code.end(), bytes);
+		}
+
+		void emit32(int value) {
+			for (int i = 0; i < 4; i++)
+				code.push_back((unsigned char)((unsigned)value >> (i * 8)));
+		}
+	};
+
+	// Evaluates node into xmm<reg> as a float, using the registers above it
+	// for operands. Variables are int slots, constants float slots
+	static bool emitExpression(Assembler& assembler, const Node& node, int reg, const SlotTable& slots) {
+		if (reg > 7)
+			return false;
+		if (node.op == 0 && node.slot >= 0) {
+			assembler.convertSlot(reg, node.slot * (int)sizeof(Value));
+			return true;
+		}
+		if (node.op == 0) {
+			assembler.loadSlot(reg, ((int)slots.names.size() - 1 - node.slot) * (int)sizeof(Value));
+			return true;
+		}
+		if (!emitExpression(assembler, *node.left, reg, slots) || !emitExpression(assembler, *node.right, reg + 1, slots))
+			return false;
+		assembler.arithmetic(node.op, reg, reg + 1);
+		return true;
+	}
+
+	// Emits a statement that keeps its int target an int, or returns false.
+	// That is "x op= y" with y read as is: a lone variable, or a whole
+	// literal, which is int text. Division by a variable is left out, dividing
+	// by 0 makes a float
+	static bool emitStatement(Assembler& assembler, const Assignment& statement) {
+		if (statement.op == '=')
+			return false;
+		bool variable = isName(statement.operand);
+		bool literal = statement.operand.find_first_not_of("0123456789") == string::npos && statement.operand.size() <= 10
+			&& strtoll(statement.operand.c_str(), nullptr, 10) <= 2147483647;
+		if (!variable && !literal)
+			return false;
+		if (statement.op == '/' && (variable || strtoll(statement.operand.c_str(), nullptr, 10) == 0))
+			return false;
+		int offset = statement.slot * (int)sizeof(Value);
+		assembler.loadInt(offset);
+		if (variable)
+			assembler.intSlotArithmetic(statement.op, statement.value->slot * (int)sizeof(Value));
+		else
+			assembler.intConstantArithmetic(statement.op, (int)strtoll(statement.operand.c_str(), nullptr, 10));
+		assembler.storeInt(offset);
+		return true;
+	}
+
+	unique_ptr<CompiledLoop> compileLoop(const vector<string>& condition, const vector<vector<string>>& body, const vector<string>& typeNames,
+		const function<bool(const string&)>& holdsInt) {
+		if (condition.size() != 3)
+			return nullptr;
+		const string& comparer = condition[1];
+		if (comparer != "<" && comparer != "<=" && comparer != ">" && comparer != ">=")
+			return nullptr;
+
+		SlotTable slots;
+		unique_ptr<Node> lhs = ExpressionParser(condition[0], slots).parse();
+		unique_ptr<Node> rhs = ExpressionParser(condition[2], slots).parse();
+		if (!lhs || !rhs)
+			return nullptr;
+
+		vector<Assignment> statements;
+		for (const vector<string>& line : body)
+			if (line.empty() || !parseStatement(line, typeNames, slots, statements))
+				return nullptr;
+		if (statements.empty())
+			return nullptr;
+		// Float variables are left to the interpreter, which rounds them to 6
+		// decimals every time they are read into an expression
+		for (const string& name : slots.names)
+			if (!holdsInt(name))
+				return nullptr;
+
+		// top: body, then the condition jumps back to top while it holds
+		Assembler assembler;
+		for (const Assignment& statement : statements)
+			if (!emitStatement(assembler, statement))
+				return nullptr;
+		if (!emitExpression(assembler, *lhs, 0, slots) || !emitExpression(assembler, *rhs, 1, slots))
+			return nullptr;
+		// a < b and a <= b are tested as b > a and b >= a, so that an unordered
+		// compare (NaN) never jumps, like the interpreter's float compare
+		if (comparer == "<" || comparer == "<=")
+			assembler.compare(1, 0);
+		else
+			assembler.compare(0, 1);
+		assembler.jumpBack(comparer == "<" || comparer == ">" ? 0x7 : 0x3, 0);
+		assembler.ret();
+
+		void* memory = mmap(nullptr, assembler.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return nullptr;
+		memcpy(memory, assembler.code.data(), assembler.code.size());
+		if (mprotect(memory, assembler.code.size(), PROT_READ | PROT_EXEC) != 0) {
+			munmap(memory, assembler.code.size());
+			return nullptr;
+		}
+
+		unique_ptr<CompiledLoop> loop(new CompiledLoop());
+		loop->names = slots.names;
+		loop->assigned = slots.assigned;
+		loop->constants = slots.constants;
+		loop->code = memory;
+		loop->codeSize = assembler.code.size();
+		return loop;
+	}
+
+	void CompiledLoop::run(vector<Value>& values) const {
+		vector<Value> slots(values);
+		for (float constant : constants) {
+			Value value;
+			value.number = constant;
+			slots.push_back(value);
+		}
+		reinterpret_cast<void (*)(Value*)>(code)(slots.data());
+		copy(slots.begin(), slots.begin() + values.size(), values.begin());
+	}
+
+	CompiledLoop::~CompiledLoop() {
+		if (code != nullptr)
+			munmap(code, codeSize);
+	}
+#else
+	bool isSupported() {
+		return false;
+	}
+
+	unique_ptr<CompiledLoop> compileLoop(const vector<string>&, const vector<vector<string>>&, const vector<string>&,
+		const function<bool(const string&)>&) {
+		return nullptr;
+	}
+
+	void CompiledLoop::run(vector<Value>&) const {
+	}
+
+	CompiledLoop::~CompiledLoop() {
+	}
+#endif
+}
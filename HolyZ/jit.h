@@ -0,0 +1,65 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+using namespace std;
+
+// Tracing JIT for hot int while loops. The interpreter runs a loop until it
+// is hot, then hands its condition and body to compileLoop. Loops whose
+// variables all hold ints, and whose body only does "x op= y" with the
+// interpreter's int math (y an int variable or a whole literal, / only by a
+// literal) are compiled to x86-64 code. The condition is compared in SSE
+// floats, as the interpreter compares. Loops over floats are left
+// interpreted, since the interpreter rounds a float to 6 decimals whenever
+// it is read into an expression, as is anything else.
+//
+// Built only with -DHOLYZ_ENABLE_JIT=ON on x86-64 Linux, and used only when
+// the interpreter runs with --jit.
+namespace Jit {
+	bool isSupported();
+
+	// One slot of a compiled loop: an int variable or a float constant
+	union Value {
+		float number;
+		int integer;
+	};
+
+	class CompiledLoop {
+	public:
+		CompiledLoop() = default;
+		~CompiledLoop();
+		CompiledLoop(const CompiledLoop&) = delete;
+		CompiledLoop& operator=(const CompiledLoop&) = delete;
+
+		// Every variable the loop reads or writes, in slot order
+		const vector<string>& variables() const { return names; }
+		// Whether the body assigns the variable at the same index
+		bool isAssigned(size_t index) const { return assigned[index]; }
+		// Runs the body, then loops for as long as the condition holds. The
+		// condition must already be true. values holds one int per variable,
+		// which must all hold ints, and receives the results
+		void run(vector<Value>& values) const;
+
+	private:
+		friend unique_ptr<CompiledLoop> compileLoop(const vector<string>&, const vector<vector<string>>&, const vector<string>&,
+			const function<bool(const string&)>&);
+
+		vector<string> names;
+		vector<bool> assigned;
+		vector<float> constants;
+		void* code = nullptr;
+		size_t codeSize = 0;
+	};
+
+	// condition is "lhs comparer rhs", with comparer one of < <= > >=. typeNames
+	// are the declaration keywords of the language. holdsInt tells if a
+	// variable holds an int now. Returns nullptr if the loop can't be compiled
+	unique_ptr<CompiledLoop> compileLoop(const vector<string>& condition, const vector<vector<string>>& body, const vector<string>& typeNames,
+		const function<bool(const string&)>& holdsInt);
+}
+
+#endif
@@ -6,5 +6,7 @@ using namespace std;
 
 boost::any ExecuteFunction(const string& functionName, const vector<boost::any>& inputVarVals);
 boost::any EvalExpression(const string& ex, unordered_map<string, boost::any>& variableValues);
+bool IsFunction(const string& funcName);
+bool BooleanLogic(const string& valA, const string& comparer, const string& valB, unordered_map<string, boost::any>& variableValues);
 
 #endif
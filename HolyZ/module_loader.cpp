@@ -0,0 +1,152 @@
+// module_loader.cpp - Include-once module loading and dependency ordering
+
+#include "module_loader.h"
+#include "script_cache.h"
+#include "system_control.h"
+#include "strops.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+namespace ModuleLoader {
+	static int threadCount = 0;
+
+	void setThreads(int threads) {
+		threadCount = max(threads, 0);
+	}
+
+	static size_t workerCount(size_t jobs) {
+		size_t threads = threadCount > 0 ? (size_t)threadCount : (size_t)thread::hardware_concurrency();
+		return max<size_t>(1, min(threads, jobs));
+	}
+
+	string canonicalPath(const string& path, const string& fromDir) {
+		filesystem::path target(path);
+		std::error_code ec;
+		if (target.is_relative() && !fromDir.empty() && !filesystem::exists(target, ec)) {
+			filesystem::path besideIncluder = filesystem::path(fromDir) / target;
+			if (filesystem::exists(besideIncluder, ec))
+				target = besideIncluder;
+		}
+		filesystem::path canonical = filesystem::weakly_canonical(target, ec);
+		if (ec)
+			return filesystem::absolute(target, ec).lexically_normal().string();
+		return canonical.string();
+	}
+
+	static string directoryOf(const string& path) {
+		return filesystem::path(path).parent_path().string();
+	}
+
+	// Reads a module's declarations, through its compiled cache when it is up to date
+	static bool readModule(Module& module, const string& version, Parser parse) {
+		FileSystem::MappedFile file;
+		if (!file.open(module.path))
+			return false;
+
+		unsigned long long hash = ScriptCache::contentHash(file.view());
+		if (!ScriptCache::load(module.path, version, hash, module.program)) {
+			module.program = parse(file.view());
+			ScriptCache::store(module.path, version, hash, module.program);
+		}
+		return true;
+	}
+
+	size_t ModuleGraph::addModule(const string& path) {
+		auto found = indexByPath.find(path);
+		if (found != indexByPath.end())
+			return found->second;
+
+		Module module;
+		module.path = path;
+		modules.push_back(module);
+		indexByPath[path] = modules.size() - 1;
+		return modules.size() - 1;
+	}
+
+	bool ModuleGraph::load(const string& entryPath, const string& version, Parser parse) {
+		vector<size_t> pending = { addModule(canonicalPath(entryPath)) };
+
+		while (!pending.empty()) {
+			// Everything found at this depth is independent, so read in parallel.
+			// The module list is only grown below, after the workers are joined
+			vector<char> readOk(pending.size(), 0);
+			size_t workers = workerCount(pending.size());
+			if (workers == 1) {
+				for (size_t i = 0; i < pending.size(); i++)
+					readOk[i] = readModule(modules[pending[i]], version, parse);
+			}
+			else {
+				atomic<size_t> nextJob(0);
+				vector<thread> pool;
+				for (size_t w = 0; w < workers; w++) {
+					pool.emplace_back([&]() {
+						for (size_t i = nextJob++; i < pending.size(); i = nextJob++)
+							readOk[i] = readModule(modules[pending[i]], version, parse);
+					});
+				}
+				for (thread& worker : pool)
+					worker.join();
+			}
+
+			if (!readOk[0] && pending[0] == 0)
+				return false;
+
+			// Collect the includes of this depth, queueing modules not seen yet
+			vector<size_t> next;
+			for (size_t i = 0; i < pending.size(); i++) {
+				size_t index = pending[i];
+				if (!readOk[i]) {
+					missing.push_back(modules[index].path);
+					continue;
+				}
+				string fromDir = directoryOf(modules[index].path);
+				for (const Declaration& declaration : modules[index].program) {
+					if (declaration.kind != 's')
+						continue;
+					const vector<string>& line = declaration.lines[0];
+					if (line.size() < 2 || toLower(line[0]) != "include")
+						continue;
+					size_t count = modules.size();
+					size_t dependency = addModule(canonicalPath(StringRaw(line[1]), fromDir));
+					modules[index].dependencies.push_back(dependency);
+					if (dependency == count)
+						next.push_back(dependency);
+				}
+			}
+			pending = next;
+		}
+		return true;
+	}
+
+	// Depth-first post-order. state: 0 unvisited, 1 on the current path, 2 done
+	void ModuleGraph::visit(size_t index, vector<char>& state, vector<size_t>& stack, vector<size_t>& sorted) {
+		state[index] = 1;
+		stack.push_back(index);
+		for (size_t dependency : modules[index].dependencies) {
+			if (state[dependency] == 1) {
+				string cycle;
+				auto start = find(stack.begin(), stack.end(), dependency);
+				for (auto it = start; it != stack.end(); ++it)
+					cycle += modules[*it].path + " -> ";
+				cyclePaths.push_back(cycle + modules[dependency].path);
+			}
+			else if (state[dependency] == 0)
+				visit(dependency, state, stack, sorted);
+		}
+		stack.pop_back();
+		state[index] = 2;
+		sorted.push_back(index);
+	}
+
+	vector<size_t> ModuleGraph::order() {
+		vector<char> state(modules.size(), 0);
+		vector<size_t> stack;
+		vector<size_t> sorted;
+		cyclePaths.clear();
+		if (!modules.empty())
+			visit(0, state, stack, sorted);
+		return sorted;
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef MODULE_LOADER_H
+#define MODULE_LOADER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#include "script_cache.h"
+
+using namespace std;
+
+// Loads a script together with everything it includes. Every module is
+// identified by its canonical path and read and parsed only once, no matter
+// how many scripts include it. Modules discovered at the same include depth
+// are parsed in parallel.
+namespace ModuleLoader {
+	typedef ParsedScript (*Parser)(string_view script);
+
+	struct Module {
+		string path;                      // Canonical path
+		ParsedScript program;             // Parsed declarations
+		vector<size_t> dependencies;      // Indices of the modules it includes
+	};
+
+	// Worker threads used for parsing, 0 picks the number of cores
+	void setThreads(int threads);
+
+	// Absolute, normalized form of an include path. Relative paths are looked up
+	// from the working directory first, then from the including script's directory
+	string canonicalPath(const string& path, const string& fromDir = "");
+
+	class ModuleGraph {
+	public:
+		// Returns false if the entry script can't be read
+		bool load(const string& entryPath, const string& version, Parser parse);
+
+		// Modules in the order they should be parsed, every module after the
+		// ones it includes. An include that closes a cycle is skipped, and
+		// reported in cycles()
+		vector<size_t> order();
+
+		const Module& at(size_t index) const { return modules[index]; }
+		Module& at(size_t index) { return modules[index]; }
+		size_t size() const { return modules.size(); }
+		const vector<string>& missingIncludes() const { return missing; }
+		const vector<string>& cycles() const { return cyclePaths; }
+
+	private:
+		size_t addModule(const string& path);
+		void visit(size_t index, vector<char>& state, vector<size_t>& stack, vector<size_t>& sorted);
+
+		vector<Module> modules;
+		unordered_map<string, size_t> indexByPath;
+		vector<string> missing;
+		vector<string> cyclePaths;
+	};
+}
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/any.hpp>
+
+#include "strops.h"
+#include "main.h"
+
+using namespace std;
+
+// Optimization pass over the script functions. Each function is optimized on
+// its first call, so startup doesn't pay for functions a run never calls.
+//   level 0: off
+//   level 1: fold constant expressions made of number literals, and drop if and
+//            while blocks whose condition is constant
+//   level 2: also treat globals that are never reassigned as constants. This
+//            scans the whole program once all modules are parsed
+// A folded expression is evaluated once with EvalExpression, the same way the
+// line would evaluate it at run time, so folding never changes a result.
+
+int optimizationLevel = 1;
+
+// Values of folded expressions. The program refers to them as "#const<index>"
+vector<boost::any> foldedConstants;
+
+struct OptimizerContext
+{
+	int level;
+	unordered_set<string> constantGlobals;
+	unordered_set<string> locals; // Names of the function being optimized
+	const unordered_map<string, vector<vector<string>>>* functions;
+};
+
+bool IsWriteOperator(const string& op)
+{
+	return op == "=" || op == "+=" || op == "-=" || op == "*=" || op == "/=" || op == "++" || op == "--";
+}
+
+// Collects every name a block of lines declares or assigns to
+void CollectWrittenNames(const vector<vector<string>>& lines, unordered_set<string>& written)
+{
+	for (const vector<string>& line : lines)
+	{
+		if (line.size() >= 3 && toLower(line.at(0)) == "global")
+			written.insert(line.at(2));
+		else if (line.size() >= 2 && countInVector(types, line.at(0)) > 0)
+			written.insert(line.at(1));
+		else if (line.size() >= 2 && IsWriteOperator(line.at(1)))
+			written.insert(split(line.at(0), '.')[0]);
+	}
+}
+
+bool IsConstantName(const string& name, const OptimizerContext& context)
+{
+	if (context.locals.count(name) > 0)
+		return false;
+	if (name == "true" || name == "false")
+		return true;
+	return context.level >= 2 && context.constantGlobals.count(name) > 0;
+}
+
+// Names are scanned the way EvalExpression scans them. An expression is
+// constant if it has no quotes, calls or member accesses, and every name in
+// it is constant. worthFolding tells if evaluating it does any work at all
+bool IsConstantExpression(const string& expression, const OptimizerContext& context, bool& worthFolding)
+{
+	worthFolding = false;
+	if (trim(expression).empty())
+		return false;
+	for (size_t i = 0; i < expression.size();)
+	{
+		char c = expression[i];
+		if (isalpha(c) || c == '_')
+		{
+			string name;
+			while (i < expression.size() && (isalpha(expression[i]) || expression[i] == '_'))
+				name += expression[i++];
+			if (i < expression.size() && (isdigit(expression[i]) || expression[i] == '.' || expression[i] == '('))
+				return false;
+			if (!IsConstantName(name, context))
+				return false;
+			worthFolding = true;
+		}
+		else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^')
+		{
+			worthFolding = true;
+			i++;
+		}
+		else if (isdigit(c) || c == '.' || c == ' ' || c == '(' || c == ')')
+			i++;
+		else
+			return false;
+	}
+	return true;
+}
+
+bool HasOperatorOutsideParenthesis(const string& expression)
+{
+	return countOutsideParenthesis(expression, '+') > 0 || countOutsideParenthesis(expression, '-') > 0 || countOutsideParenthesis(expression, '*') > 0
+		|| countOutsideParenthesis(expression, '/') > 0 || countOutsideParenthesis(expression, '^') > 0;
+}
+
+string PoolConstant(const string& expression)
+{
+	unordered_map<string, boost::any> noLocals;
+	foldedConstants.push_back(EvalExpression(expression, noLocals));
+	return "#const" + to_string(foldedConstants.size() - 1);
+}
+
+// Replaces constant names in an arithmetic expression with the text
+// EvalExpression would substitute for them
+string SubstituteConstantNames(const string& expression, const OptimizerContext& context)
+{
+	string result;
+	for (size_t i = 0; i < expression.size();)
+	{
+		char c = expression[i];
+		if (isalpha(c) || c == '_')
+		{
+			string name;
+			while (i < expression.size() && (isalpha(expression[i]) || expression[i] == '.' || expression[i] == '_'))
+				name += expression[i++];
+			bool isCall = i < expression.size() && expression[i] == '(';
+			if (!isCall && count(name, '.') == 0 && IsConstantName(name, context) && name != "true" && name != "false")
+			{
+				unordered_map<string, boost::any> noLocals;
+				result += AnyAsString(EvalExpression(name, noLocals));
+			}
+			else
+				result += name;
+		}
+		else
+			result += expression[i++];
+	}
+	return result;
+}
+
+string FoldExpression(const string& ex, const OptimizerContext& context, bool allowPooling = true);
+
+// Folds the arguments of "Name(a, b)", when Name is a ZS native or a script
+// function, as those evaluate each argument on its own
+string FoldCallArguments(const string& call, const OptimizerContext& context)
+{
+	size_t open = call.find('(');
+	string name = trim(call.substr(0, open));
+	if (!startsWith(name, "ZS.") && context.functions->count(name) == 0)
+		return call;
+
+	string inside = betweenChars(call, '(', ')');
+	if (trim(inside).empty())
+		return call;
+	vector<string> args = splitNoOverlap(inside, ',', '(', ')');
+	string folded = name + "(";
+	for (size_t i = 0; i < args.size(); i++)
+		folded += (i > 0 ? ", " : "") + FoldExpression(trim(args[i]), context);
+	return folded + ")";
+}
+
+string FoldExpression(const string& ex, const OptimizerContext& context, bool allowPooling)
+{
+	string expression = trim(ex);
+	if (expression.empty() || count(expression, '\"') > 0)
+		return expression;
+
+	bool worthFolding;
+	if (allowPooling && IsConstantExpression(expression, context, worthFolding))
+		return worthFolding ? PoolConstant(expression) : expression;
+
+	size_t open = expression.find('(');
+	bool isCall = open != string::npos && open > 0 && expression.back() == ')' && (isalpha(expression[0]) || expression[0] == '_');
+	if (!HasOperatorOutsideParenthesis(expression) || startsWith(expression, "ZS."))
+		return isCall ? FoldCallArguments(expression, context) : expression;
+
+	// Arithmetic containing calls is left as is, it is evaluated as a whole
+	for (size_t i = 1; i < expression.size(); i++)
+		if (expression[i] == '(' && (isalpha(expression[i - 1]) || expression[i - 1] == '_'))
+			return expression;
+	return SubstituteConstantNames(expression, context);
+}
+
+// Rewrites the words of a line from index start on as one folded expression
+void FoldLineTail(vector<string>& line, int start, const OptimizerContext& context, bool allowPooling = true)
+{
+	if ((int)line.size() <= start)
+		return;
+	string folded = FoldExpression(unWrapVec(slice(line, start, -1)), context, allowPooling);
+	vector<string> foldedLine(line.begin(), line.begin() + start);
+	for (const string& word : split(folded, ' '))
+		foldedLine.push_back(word);
+	line = foldedLine;
+}
+
+// Finds the extent of the if or while block starting at line start, with the
+// same bracket counting ProcessLine uses. Returns false if it is unterminated
+bool FindBlockEnd(const vector<vector<string>>& lines, int start, int& end)
+{
+	int numOfBrackets = 0;
+	for (const string& word : lines.at(start))
+		if (count(word, '{') != 0)
+		{
+			numOfBrackets = 1;
+			break;
+		}
+	for (end = start + 1; end < (int)lines.size(); end++)
+	{
+		numOfBrackets += countInVector(lines.at(end), "{") - countInVector(lines.at(end), "}");
+		if (numOfBrackets == 0)
+			return true;
+	}
+	return false;
+}
+
+// Folds the sides of an if or while condition. Returns 1 or 0 if the
+// condition is constant, -1 otherwise
+int FoldCondition(vector<string>& line, const OptimizerContext& context)
+{
+	// Only plain "a comparer b" conditions, with the bracket on the next line,
+	// and no parenthesis or '!' belonging to a longer condition
+	static const vector<string> comparers = { "==", "!=", "<", ">", "<=", ">=" };
+	if (line.size() != 4 || count(unWrapVec(line), '{') != 0 || countInVector(comparers, line.at(2)) == 0)
+		return -1;
+	for (int side : { 1, 3 })
+		if (line.at(side)[0] == '!' || count(line.at(side), '(') != count(line.at(side), ')'))
+			return -1;
+
+	bool constant = true;
+	for (int side : { 1, 3 })
+	{
+		bool worthFolding;
+		if (startsWith(line.at(side), "#const"))
+			continue;
+		if (IsConstantExpression(line.at(side), context, worthFolding))
+		{
+			if (worthFolding)
+				line.at(side) = PoolConstant(line.at(side));
+		}
+		else
+			constant = false;
+	}
+	if (!constant)
+		return -1;
+
+	unordered_map<string, boost::any> noLocals;
+	return BooleanLogic(line.at(1), line.at(2), line.at(3), noLocals) ? 1 : 0;
+}
+
+void OptimizeLines(vector<vector<string>>& lines, int firstLine, const OptimizerContext& context)
+{
+	for (int lineNum = firstLine; lineNum < (int)lines.size(); lineNum++)
+	{
+		vector<string>& line = lines.at(lineNum);
+		const string& first = line.at(0);
+
+		if (toLower(first) == "if" || toLower(first) == "while")
+		{
+			int result = FoldCondition(line, context);
+			int end;
+			if (result == -1 || !FindBlockEnd(lines, lineNum, end))
+				continue;
+			// Blocks followed by an else are kept as they are
+			if (end + 1 < (int)lines.size() && toLower(lines.at(end + 1).at(0)) == "else")
+				continue;
+
+			vector<vector<string>> body(lines.begin() + lineNum + 1, lines.begin() + end);
+			if (!body.empty() && unWrapVec(body.front()) == "{")
+				body.erase(body.begin());
+			if (result == 1)
+			{
+				// A loop that is always true still has to loop, and an if body
+				// can only be inlined when its break or continue mean the same
+				if (toLower(first) == "while")
+					continue;
+				bool controlFlow = false;
+				for (const vector<string>& bodyLine : body)
+					if (bodyLine.at(0) == "break" || bodyLine.at(0) == "continue")
+						controlFlow = true;
+				if (controlFlow)
+					continue;
+			}
+			else
+				body.clear();
+
+			lines.erase(lines.begin() + lineNum, lines.begin() + end + 1);
+			lines.insert(lines.begin() + lineNum, body.begin(), body.end());
+			lineNum--; // Optimize the inlined lines too
+		}
+		else if (toLower(first) == "return" || toLower(first) == "print")
+			FoldLineTail(line, 1, context);
+		else if (toLower(first) == "global" && line.size() >= 5 && line.at(3) == "=")
+			FoldLineTail(line, 4, context);
+		else if (countInVector(types, first) > 0 && line.size() >= 4 && line.at(2) == "=")
+			FoldLineTail(line, 3, context);
+		else if (line.size() >= 3 && (line.at(1) == "=" || line.at(1) == "-=" || line.at(1) == "*=" || line.at(1) == "/="))
+			FoldLineTail(line, 2, context);
+		// "+=" evaluates the right side inside a larger expression
+		else if (line.size() >= 3 && line.at(1) == "+=")
+			FoldLineTail(line, 2, context, false);
+		else if (line.size() >= 1 && count(first, '(') > 0)
+			FoldLineTail(line, 0, context);
+	}
+}
+
+// State shared by every function's optimization, set up by OptimizeProgram
+OptimizerContext programContext;
+
+// Script functions that haven't run yet, and so aren't optimized yet
+unordered_set<string> unoptimizedFunctions;
+
+void OptimizeProgram(unordered_map<string, vector<vector<string>>>& functions, const unordered_map<string, boost::any>& globals,
+	const unordered_map<string, ClassDefinition>& classes, int level)
+{
+	unoptimizedFunctions.clear();
+	if (level <= 0)
+		return;
+
+	programContext = OptimizerContext();
+	programContext.level = level;
+	programContext.functions = &functions;
+
+	// Globals of simple types that no function or method ever writes
+	if (level >= 2)
+	{
+		unordered_set<string> written;
+		for (const auto& function : functions)
+			CollectWrittenNames(function.second, written);
+		for (const auto& classDef : classes)
+			for (const ClassMethod& method : classDef.second.methods)
+				CollectWrittenNames(method.body, written);
+		for (const auto& global : globals)
+			if (any_type(global.second) <= 3 && written.count(global.first) == 0)
+				programContext.constantGlobals.insert(global.first);
+	}
+
+	for (const auto& function : functions)
+		unoptimizedFunctions.insert(function.first);
+}
+
+// Optimizes a function the first time it is called. Returns false if it
+// already was, or optimization is off
+bool OptimizeFunction(const string& name, vector<vector<string>>& lines)
+{
+	if (unoptimizedFunctions.erase(name) == 0)
+		return false;
+
+	// The first line holds the parameters
+	programContext.locals.clear();
+	for (const string& param : lines.at(0))
+		programContext.locals.insert(param);
+	for (int lineNum = 1; lineNum < (int)lines.size(); lineNum++)
+	{
+		const vector<string>& line = lines.at(lineNum);
+		if (line.size() >= 2 && countInVector(types, line.at(0)) > 0)
+			programContext.locals.insert(line.at(1));
+	}
+	OptimizeLines(lines, 1, programContext);
+	return true;
+}
+
+#endif
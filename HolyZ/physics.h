@@ -0,0 +1,182 @@
+
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#ifdef HOLYZ_GRAPHICS_ENABLED
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <math.h>
+#include "graphics.h"
+
+using namespace std;
+
+// Collision world for ZS.Physics. Bodies are boxes registered under an id
+// chosen by the script. queryOverlaps puts them into a uniform grid of square
+// cells, and only boxes sharing a cell are tested against each other, so the
+// cost follows the number of nearby boxes instead of every pair. Rotated
+// boxes are tested exactly with RotRectsCollision
+class PhysicsWorld
+{
+public:
+	explicit PhysicsWorld(float cellSize)
+		: cellSize(cellSize > 0 ? cellSize : 64.0f)
+	{}
+
+	// center and size are in pixels, angle in degrees like Sprite's
+	void set(int id, Vec2 center, Vec2 size, float angle)
+	{
+		Body& body = bodies[id];
+		body.box.C = center;
+		body.box.S = Vec2(fabs(size.x) / 2, fabs(size.y) / 2);
+		body.box.ang = angle * 3.14159265f / 180.0f;
+
+		// Bounds of the rotated box
+		float c = fabs(cos(body.box.ang)), s = fabs(sin(body.box.ang));
+		float halfW = c * body.box.S.x + s * body.box.S.y;
+		float halfH = s * body.box.S.x + c * body.box.S.y;
+		body.minX = center.x - halfW;
+		body.maxX = center.x + halfW;
+		body.minY = center.y - halfH;
+		body.maxY = center.y + halfH;
+	}
+
+	bool remove(int id)
+	{
+		return bodies.erase(id) > 0;
+	}
+
+	// Finds every overlapping pair of bodies, each once with the lower id
+	// first, sorted by id
+	const vector<pair<int, int>>& queryOverlaps()
+	{
+		overlaps.clear();
+		cells.clear();
+		vector<const Body*> oversized;
+
+		ordered.clear();
+		for (auto& body : bodies)
+		{
+			body.second.id = body.first;
+			ordered.push_back(&body.second);
+		}
+
+		for (const Body* body : ordered)
+		{
+			int x0 = cellOf(body->minX), x1 = cellOf(body->maxX);
+			int y0 = cellOf(body->minY), y1 = cellOf(body->maxY);
+			// Boxes spanning many cells are tested against every box instead
+			if ((long long)(x1 - x0 + 1) * (y1 - y0 + 1) > MAX_CELLS_PER_BODY)
+			{
+				oversized.push_back(body);
+				continue;
+			}
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					cells[cellKey(x, y)].push_back(body);
+		}
+
+		for (const auto& cell : cells)
+		{
+			const vector<const Body*>& inCell = cell.second;
+			for (size_t i = 0; i < inCell.size(); i++)
+				for (size_t j = i + 1; j < inCell.size(); j++)
+				{
+					const Body* a = inCell[i];
+					const Body* b = inCell[j];
+					if (!boundsOverlap(*a, *b))
+						continue;
+					// Boxes sharing several cells are only tested in the cell
+					// holding the corner of their overlap
+					if (cellKey(cellOf(max(a->minX, b->minX)), cellOf(max(a->minY, b->minY))) != cell.first)
+						continue;
+					test(*a, *b);
+				}
+		}
+
+		for (size_t i = 0; i < oversized.size(); i++)
+			for (const Body* other : ordered)
+			{
+				// Two oversized boxes are tested once
+				if (other == oversized[i] || (isOversized(*other, oversized) && other->id < oversized[i]->id))
+					continue;
+				if (boundsOverlap(*oversized[i], *other))
+					test(*oversized[i], *other);
+			}
+
+		sort(overlaps.begin(), overlaps.end());
+		return overlaps;
+	}
+
+	const vector<pair<int, int>>& lastOverlaps() const
+	{
+		return overlaps;
+	}
+
+private:
+	struct Body
+	{
+		_RotRect box;
+		float minX, minY, maxX, maxY;
+		int id;
+	};
+
+	static const long long MAX_CELLS_PER_BODY = 64;
+
+	float cellSize;
+	unordered_map<int, Body> bodies;
+	unordered_map<long long, vector<const Body*>> cells;
+	vector<const Body*> ordered;
+	vector<pair<int, int>> overlaps;
+
+	int cellOf(float coordinate) const
+	{
+		return (int)floor(coordinate / cellSize);
+	}
+
+	static long long cellKey(int x, int y)
+	{
+		return ((long long)x << 32) ^ (unsigned int)y;
+	}
+
+	static bool boundsOverlap(const Body& a, const Body& b)
+	{
+		return a.minX <= b.maxX && b.minX <= a.maxX && a.minY <= b.maxY && b.minY <= a.maxY;
+	}
+
+	static bool isOversized(const Body& body, const vector<const Body*>& oversized)
+	{
+		return find(oversized.begin(), oversized.end(), &body) != oversized.end();
+	}
+
+	// Axis aligned boxes whose bounds overlap do collide, rotated ones are
+	// tested exactly
+	void test(const Body& a, const Body& b)
+	{
+		if (a.box.ang != 0 || b.box.ang != 0)
+		{
+			_RotRect boxA = a.box, boxB = b.box;
+			if (!RotRectsCollision(&boxA, &boxB))
+				return;
+		}
+		overlaps.push_back(a.id < b.id ? make_pair(a.id, b.id) : make_pair(b.id, a.id));
+	}
+};
+
+// Worlds made by ZS.Physics.World, which returns the index
+vector<PhysicsWorld> physicsWorlds;
+
+PhysicsWorld* GetPhysicsWorld(int handle)
+{
+	if (handle < 0 || handle >= (int)physicsWorlds.size())
+	{
+		LogWarning("invalid physics world " + to_string(handle));
+		return nullptr;
+	}
+	return &physicsWorlds[handle];
+}
+
+#endif // HOLYZ_GRAPHICS_ENABLED
+
+#endif
@@ -0,0 +1,247 @@
+// script_cache.cpp - Reading and writing of compiled script caches
+
+#include "script_cache.h"
+#include "system_control.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32) || defined(_WIN64)
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+namespace ScriptCache {
+	static const char cacheMagic[4] = { 'Z', 'S', 'C', '2' };
+	static string cacheDir;
+	static bool enabled = true;
+
+	void setCacheDir(const string& dir) {
+		cacheDir = dir;
+	}
+
+	void setEnabled(bool enable) {
+		enabled = enable;
+	}
+
+	bool isEnabled() {
+		return enabled;
+	}
+
+	// 64-bit FNV-1a, taken 8 bytes at a time with the high half folded back
+	// down after each multiply. Scripts and caches are hashed on every start
+	unsigned long long contentHash(string_view contents) {
+		const unsigned long long prime = 1099511628211ULL;
+		unsigned long long hash = 14695981039346656037ULL;
+		size_t i = 0;
+		for (; i + sizeof(hash) <= contents.size(); i += sizeof(hash)) {
+			unsigned long long word;
+			memcpy(&word, contents.data() + i, sizeof(word));
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 32;
+		}
+		for (; i < contents.size(); i++) {
+			hash ^= (unsigned char)contents[i];
+			hash *= prime;
+		}
+		return hash;
+	}
+
+	static bool makeDirectory(const string& path) {
+#if defined(_WIN32) || defined(_WIN64)
+		return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+		return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+	}
+
+	// The per-user cache directory, created on first use. Empty if there is
+	// no home to put it in
+	static const string& userCacheDir() {
+		static string dir = [] {
+#if defined(_WIN32) || defined(_WIN64)
+			const char* base = getenv("LOCALAPPDATA");
+			if (!base || !*base || !makeDirectory(string(base) + "\\HolyZ"))
+				return string();
+			string path = string(base) + "\\HolyZ\\cache";
+#else
+			string base;
+			if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+				base = xdg;
+			else if (const char* home = getenv("HOME"); home && *home)
+				base = string(home) + "/.cache";
+			else
+				return string();
+			string path = base + "/holyz";
+			makeDirectory(base);
+#endif
+			return makeDirectory(path) ? path : string();
+		}();
+		return dir;
+	}
+
+	string cachePath(const string& scriptPath) {
+		const string& dir = cacheDir.empty() ? userCacheDir() : cacheDir;
+		if (dir.empty())
+			return "";
+		// One flat directory, named after the script's absolute path
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.zsc", contentHash(FileSystem::getAbsolutePath(scriptPath)));
+		return dir + "/" + name;
+	}
+
+	// Bounds-checked reader over the mapped cache file
+	class CacheReader {
+	public:
+		CacheReader(string_view data) : data(data) {}
+
+		bool read(void* out, size_t count) {
+			if (data.size() - offset < count) return false;
+			memcpy(out, data.data() + offset, count);
+			offset += count;
+			return true;
+		}
+
+		// Every counted item takes at least a byte, so a count larger than
+		// what is left of the file is corrupt and rejected before allocating
+		bool readCount(unsigned int& count) {
+			return read(&count, sizeof(count)) && count <= data.size() - offset;
+		}
+
+		bool readString(string& out) {
+			unsigned int length;
+			if (!readCount(length)) return false;
+			out.assign(data.data() + offset, length);
+			offset += length;
+			return true;
+		}
+
+		bool atEnd() const { return offset == data.size(); }
+
+	private:
+		string_view data;
+		size_t offset = 0;
+	};
+
+	static void appendValue(string& out, const void* value, size_t size) {
+		out.append((const char*)value, size);
+	}
+
+	static void appendString(string& out, const string& value) {
+		unsigned int length = (unsigned int)value.size();
+		appendValue(out, &length, sizeof(length));
+		out += value;
+	}
+
+	static void appendLines(string& out, const vector<vector<string>>& lines) {
+		unsigned int lineCount = (unsigned int)lines.size();
+		appendValue(out, &lineCount, sizeof(lineCount));
+		for (const auto& line : lines) {
+			unsigned int wordCount = (unsigned int)line.size();
+			appendValue(out, &wordCount, sizeof(wordCount));
+			for (const auto& word : line)
+				appendString(out, word);
+		}
+	}
+
+	static bool readLines(CacheReader& reader, vector<vector<string>>& lines) {
+		unsigned int lineCount;
+		if (!reader.readCount(lineCount))
+			return false;
+		lines.resize(lineCount);
+		for (auto& line : lines) {
+			unsigned int wordCount;
+			if (!reader.readCount(wordCount))
+				return false;
+			line.resize(wordCount);
+			for (auto& word : line)
+				if (!reader.readString(word))
+					return false;
+		}
+		return true;
+	}
+
+	bool load(const string& scriptPath, const string& version, unsigned long long hash, ParsedScript& script) {
+		if (!enabled) return false;
+
+		string path = cachePath(scriptPath);
+		FileSystem::MappedFile cacheFile;
+		if (path.empty() || !cacheFile.open(path)) return false;
+
+		// The file ends with a hash of everything before it, so a cache that was
+		// damaged on disk is rebuilt instead of loading a different program
+		string_view contents = cacheFile.view();
+		unsigned long long checksum;
+		if (contents.size() < sizeof(checksum))
+			return false;
+		contents.remove_suffix(sizeof(checksum));
+		memcpy(&checksum, contents.data() + contents.size(), sizeof(checksum));
+		if (checksum != contentHash(contents))
+			return false;
+
+		CacheReader reader(contents);
+		char magic[4];
+		string cachedVersion;
+		unsigned long long cachedHash;
+		unsigned int declarationCount;
+		if (!reader.read(magic, sizeof(magic)) || memcmp(magic, cacheMagic, sizeof(magic)) != 0)
+			return false;
+		if (!reader.readString(cachedVersion) || cachedVersion != version)
+			return false;
+		if (!reader.read(&cachedHash, sizeof(cachedHash)) || cachedHash != hash)
+			return false;
+		if (!reader.readCount(declarationCount))
+			return false;
+
+		ParsedScript cachedScript(declarationCount);
+		for (Declaration& declaration : cachedScript) {
+			if (!reader.read(&declaration.kind, sizeof(declaration.kind)) || !reader.readString(declaration.name))
+				return false;
+			if (!readLines(reader, declaration.lines))
+				return false;
+		}
+		if (!reader.atEnd())
+			return false;
+
+		script = std::move(cachedScript);
+		return true;
+	}
+
+	bool store(const string& scriptPath, const string& version, unsigned long long hash, const ParsedScript& script) {
+		if (!enabled) return false;
+
+		string contents(cacheMagic, sizeof(cacheMagic));
+		appendString(contents, version);
+		appendValue(contents, &hash, sizeof(hash));
+		unsigned int declarationCount = (unsigned int)script.size();
+		appendValue(contents, &declarationCount, sizeof(declarationCount));
+		for (const Declaration& declaration : script) {
+			appendValue(contents, &declaration.kind, sizeof(declaration.kind));
+			appendString(contents, declaration.name);
+			appendLines(contents, declaration.lines);
+		}
+		unsigned long long checksum = contentHash(contents);
+		appendValue(contents, &checksum, sizeof(checksum));
+
+		// Write to a unique temporary file then rename it in place, so concurrent
+		// runs of the same script never see a half written cache
+		string path = cachePath(scriptPath);
+		if (path.empty()) return false;
+		string tempPath = path + "." + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (!file) return false;
+		bool ok = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+		ok = fclose(file) == 0 && ok;
+#if defined(_WIN32) || defined(_WIN64)
+		if (ok) remove(path.c_str());
+#endif
+		if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+			remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// One top level item of a parsed script, in source order
+struct Declaration {
+	char kind;                      // 'f' function, 'c' class, 's' statement
+	string name;                    // Function or class name
+	vector<vector<string>> lines;   // Parameters then body, class body, or the statement
+};
+typedef vector<Declaration> ParsedScript;
+
+// Compiled script cache (.zsc files). A script is stored parsed, as the
+// functions, classes and top level statements parseHolyZ loads, so later runs
+// skip both tokenizing and splitting the script into declarations. Entries are
+// keyed by a hash of the script contents and the interpreter version.
+namespace ScriptCache {
+	// Where the cache of a script lives, in the cache directory if one is set
+	// or else the user's cache directory ($XDG_CACHE_HOME/holyz, ~/.cache/holyz
+	// or %LOCALAPPDATA%\HolyZ\cache). Empty if there is nowhere to put it
+	string cachePath(const string& scriptPath);
+	void setCacheDir(const string& dir);
+	void setEnabled(bool enabled);
+	bool isEnabled();
+
+	unsigned long long contentHash(string_view contents);
+
+	// Returns false if there is no valid cache for this exact content and version
+	bool load(const string& scriptPath, const string& version, unsigned long long hash, ParsedScript& script);
+	bool store(const string& scriptPath, const string& version, unsigned long long hash, const ParsedScript& script);
+}
+
+#endif
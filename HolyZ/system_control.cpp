@@ -7,10 +7,18 @@
 #endif
 
 #include "system_control.h"
+#include "strops.h"
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <climits>
 #include <algorithm>
+#include <memory>
+#include <new>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #if defined(_WIN32) || defined(_WIN64)
     #include <windows.h>
@@ -22,9 +30,20 @@
     #include <unistd.h>
     #include <sys/types.h>
     #include <sys/stat.h>
+    #include <sys/mman.h>
     #include <dirent.h>
     #include <signal.h>
     #include <sys/utsname.h>
+    #include <sys/wait.h>
+    #include <sys/statvfs.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <cerrno>
+    #include <dlfcn.h>
+#endif
+
+#if defined(__linux__)
+    #include <sys/syscall.h>
 #endif
 
 // Performance stats
@@ -45,15 +64,299 @@ namespace Performance {
 
 // File System Implementation
 namespace FileSystem {
+    MappedFile::MappedFile(MappedFile&& other) noexcept {
+        *this = std::move(other);
+    }
+    
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            close();
+            copied = other.copied;
+            contents = std::move(other.contents);
+            mapped = copied ? contents.data() : other.mapped;
+            length = other.length;
+            opened = other.opened;
+#if defined(_WIN32) || defined(_WIN64)
+            fileHandle = other.fileHandle;
+            mappingHandle = other.mappingHandle;
+            other.fileHandle = nullptr;
+            other.mappingHandle = nullptr;
+#endif
+            other.mapped = nullptr;
+            other.length = 0;
+            other.opened = false;
+            other.copied = false;
+        }
+        return *this;
+    }
+    
+    bool MappedFile::open(const string& path) {
+        close();
+#if defined(_WIN32) || defined(_WIN64)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            CloseHandle(file);
+            return false;
+        }
+        if (GetFileType(file) != FILE_TYPE_DISK || fileSize.QuadPart == 0) {
+            // Pipes and devices can't be mapped, read them until the end
+            char buffer[65536];
+            DWORD bytesRead = 0;
+            while (ReadFile(file, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0)
+                contents.append(buffer, bytesRead);
+            CloseHandle(file);
+            copied = true;
+            mapped = contents.data();
+            length = contents.size();
+            opened = true;
+            return true;
+        }
+        fileHandle = file;
+        length = (size_t)fileSize.QuadPart;
+        opened = true;
+        
+        mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle) {
+            mapped = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (!mapped) {
+            close();
+            return false;
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+        
+        struct stat st;
+        if (fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+        if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+            // Pipes, devices and /proc files can't be mapped or don't report
+            // their size, read them until the end
+            char buffer[65536];
+            ssize_t bytesRead;
+            while ((bytesRead = ::read(fd, buffer, sizeof(buffer))) != 0) {
+                if (bytesRead < 0) {
+                    if (errno == EINTR) continue;
+                    ::close(fd);
+                    contents.clear();
+                    return false;
+                }
+                contents.append(buffer, (size_t)bytesRead);
+            }
+            ::close(fd);
+            copied = true;
+            mapped = contents.data();
+            length = contents.size();
+            opened = true;
+            return true;
+        }
+        length = (size_t)st.st_size;
+        opened = true;
+        if (length > 0) {
+            void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                opened = false;
+                return false;
+            }
+            madvise(addr, length, MADV_SEQUENTIAL);
+            mapped = (const char*)addr;
+        }
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+#endif
+        return true;
+    }
+    
+    void MappedFile::close() {
+#if defined(_WIN32) || defined(_WIN64)
+        if (mapped && !copied) UnmapViewOfFile(mapped);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle) CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = nullptr;
+#else
+        if (mapped && !copied) munmap((void*)mapped, length);
+#endif
+        mapped = nullptr;
+        length = 0;
+        opened = false;
+        copied = false;
+        contents.clear();
+    }
+    
+    static const align_val_t streamBufferAlignment = align_val_t(4096);
+    
+    bool FileStream::open(const string& path, const string& mode) {
+        close();
+        const char* openMode;
+        if (mode == "r")
+            openMode = "rb";
+        else if (mode == "w")
+            openMode = "wb";
+        else if (mode == "a")
+            openMode = "ab";
+        else
+            return false;
+        
+        file = fopen(path.c_str(), openMode);
+        if (!file) return false;
+        // All buffering happens in our own buffer
+        setvbuf(file, nullptr, _IONBF, 0);
+        buffer = static_cast<char*>(operator new(bufferSize, streamBufferAlignment));
+        writing = mode != "r";
+        reachedEnd = false;
+        bufferStart = bufferEnd = 0;
+        return true;
+    }
+    
+    void FileStream::close() {
+        if (file) {
+            if (writing) flush();
+            fclose(file);
+            file = nullptr;
+        }
+        if (buffer) {
+            operator delete(buffer, streamBufferAlignment);
+            buffer = nullptr;
+        }
+        bufferStart = bufferEnd = 0;
+    }
+    
+    // Refills the read buffer after the unread bytes, returns false once nothing more can be read
+    bool FileStream::fill() {
+        if (!file || writing || reachedEnd) return false;
+        if (bufferStart > 0) {
+            ::memmove(buffer, buffer + bufferStart, bufferEnd - bufferStart);
+            bufferEnd -= bufferStart;
+            bufferStart = 0;
+        }
+        size_t bytesRead = fread(buffer + bufferEnd, 1, bufferSize - bufferEnd, file);
+        if (bytesRead == 0) {
+            reachedEnd = true;
+            return false;
+        }
+        bufferEnd += bytesRead;
+        return true;
+    }
+    
+    bool FileStream::readLine(string& line) {
+        line.clear();
+        if (!file || writing) return false;
+        
+        while (true) {
+            const char* start = buffer + bufferStart;
+            const char* newline = (const char*)memchr(start, '\n', bufferEnd - bufferStart);
+            if (newline) {
+                line.append(start, newline - start);
+                bufferStart += (newline - start) + 1;
+                break;
+            }
+            line.append(start, bufferEnd - bufferStart);
+            bufferStart = bufferEnd = 0;
+            if (!fill()) {
+                if (line.empty()) return false;
+                break;
+            }
+        }
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        return true;
+    }
+    
+    string FileStream::readChunk(size_t count) {
+        string chunk;
+        if (!file || writing) return chunk;
+        
+        while (chunk.size() < count) {
+            if (bufferStart == bufferEnd && !fill()) break;
+            size_t take = min(count - chunk.size(), bufferEnd - bufferStart);
+            chunk.append(buffer + bufferStart, take);
+            bufferStart += take;
+        }
+        return chunk;
+    }
+    
+    bool FileStream::write(string_view data) {
+        if (!file || !writing) return false;
+        if (bufferEnd + data.size() > bufferSize && !flush())
+            return false;
+        // Anything larger than the buffer goes straight to the file
+        if (data.size() >= bufferSize)
+            return fwrite(data.data(), 1, data.size(), file) == data.size();
+        ::memcpy(buffer + bufferEnd, data.data(), data.size());
+        bufferEnd += data.size();
+        return true;
+    }
+    
+    bool FileStream::flush() {
+        if (!file || !writing) return false;
+        bool ok = fwrite(buffer, 1, bufferEnd, file) == bufferEnd;
+        bufferEnd = 0;
+        return ok;
+    }
+    
+    bool FileStream::endOfFile() {
+        if (!file || writing) return true;
+        if (bufferStart < bufferEnd) return false;
+        return !fill();
+    }
+    
+    static unordered_map<int, unique_ptr<FileStream>> openStreams;
+    static int nextStreamHandle = 1;
+    
+    int openStream(const string& path, const string& mode) {
+        Performance::recordFunctionCall();
+        unique_ptr<FileStream> stream(new FileStream());
+        if (!stream->open(path, mode)) {
+            cerr << "Cannot open file stream: " << path << endl;
+            return -1;
+        }
+        int handle = nextStreamHandle++;
+        openStreams[handle] = std::move(stream);
+        return handle;
+    }
+    
+    FileStream* getStream(int handle) {
+        auto it = openStreams.find(handle);
+        if (it == openStreams.end()) {
+            cerr << "Invalid file handle: " << handle << endl;
+            return nullptr;
+        }
+        return it->second.get();
+    }
+    
+    bool closeStream(int handle) {
+        return openStreams.erase(handle) > 0;
+    }
+    
+    bool writeAll(const string& path, string_view content) {
+        Performance::recordFunctionCall();
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            cerr << "Cannot open file for writing: " << path << endl;
+            return false;
+        }
+        setvbuf(file, nullptr, _IONBF, 0);
+        bool ok = fwrite(content.data(), 1, content.size(), file) == content.size();
+        return fclose(file) == 0 && ok;
+    }
+    
     string fileRead(const string& path) {
         try {
-            ifstream file(path);
-            if (!file.is_open()) {
+            MappedFile file;
+            if (!file.open(path)) {
                 throw HolyZException("Cannot open file: " + path);
             }
-            stringstream buffer;
-            buffer << file.rdbuf();
-            return buffer.str();
+            return string(file.view());
         } catch (const exception& e) {
             throw HolyZException("File read error: " + string(e.what()));
         }
@@ -113,6 +416,261 @@ namespace FileSystem {
         return files;
     }
     
+    // Lists a single directory. Entries go to 'entries', and subdirectories to
+    // 'subdirs' (relative paths) so the caller decides how to recurse.
+    static void scanDirectory(const string& root, const string& relPath,
+                              vector<DirEntry>& entries, vector<string>& subdirs) {
+        string dirPath = relPath.empty() ? root : root + "/" + relPath;
+        string prefix = relPath.empty() ? "" : relPath + "/";
+#if defined(_WIN32) || defined(_WIN64)
+        WIN32_FIND_DATAA findData;
+        HANDLE findHandle = FindFirstFileA((dirPath + "\\*").c_str(), &findData);
+        if (findHandle == INVALID_HANDLE_VALUE) return;
+        
+        do {
+            string name = findData.cFileName;
+            if (name == "." || name == "..") continue;
+            DirEntry entry;
+            entry.path = prefix + name;
+            entry.size = ((long long)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+            // FILETIME counts 100ns intervals since 1601
+            long long fileTime = ((long long)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+            entry.modifiedTime = fileTime / 10000000LL - 11644473600LL;
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                entry.type = 'l';
+            else if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                entry.type = 'd';
+            else
+                entry.type = 'f';
+            if (entry.type == 'd') subdirs.push_back(entry.path);
+            entries.push_back(entry);
+        } while (FindNextFileA(findHandle, &findData));
+        
+        FindClose(findHandle);
+#else
+        int dirFd = ::open(dirPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd == -1) return;
+        
+        auto addEntry = [&](const char* name, unsigned char direntType) {
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return;
+            DirEntry entry;
+            entry.path = prefix + name;
+            entry.size = 0;
+            entry.modifiedTime = 0;
+            
+            struct stat st;
+            bool haveStat = fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+            if (haveStat) {
+                entry.size = st.st_size;
+                entry.modifiedTime = st.st_mtime;
+            }
+            if (direntType == DT_UNKNOWN && haveStat) {
+                if (S_ISREG(st.st_mode)) direntType = DT_REG;
+                else if (S_ISDIR(st.st_mode)) direntType = DT_DIR;
+                else if (S_ISLNK(st.st_mode)) direntType = DT_LNK;
+            }
+            switch (direntType) {
+                case DT_REG: entry.type = 'f'; break;
+                case DT_DIR: entry.type = 'd'; break;
+                case DT_LNK: entry.type = 'l'; break;
+                default: entry.type = 'o'; break;
+            }
+            if (entry.type == 'd') subdirs.push_back(entry.path);
+            entries.push_back(entry);
+        };
+        
+#if defined(__linux__)
+        // Raw getdents64 reads many entries per syscall, without readdir's per-entry copying
+        struct LinuxDirent64 {
+            unsigned long long d_ino;
+            long long d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+        alignas(8) char buffer[64 * 1024];
+        while (true) {
+            long bytesRead = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+            if (bytesRead <= 0) break;
+            for (long offset = 0; offset < bytesRead;) {
+                LinuxDirent64* dirent = (LinuxDirent64*)(buffer + offset);
+                addEntry(dirent->d_name, dirent->d_type);
+                offset += dirent->d_reclen;
+            }
+        }
+        ::close(dirFd);
+#else
+        DIR* dir = fdopendir(dirFd);
+        if (!dir) {
+            ::close(dirFd);
+            return;
+        }
+        struct dirent* dirent;
+        while ((dirent = readdir(dir)) != nullptr) {
+            addEntry(dirent->d_name, dirent->d_type);
+        }
+        closedir(dir);  // Also closes dirFd
+#endif
+#endif
+    }
+    
+    class DirWalker {
+    public:
+        DirWalker(const string& rootPath, bool recurse, int threadCount)
+            : root(rootPath), recursive(recurse) {
+            pendingDirs.push_back("");
+            for (int i = 0; i < threadCount && threadCount > 1; i++) {
+                workers.emplace_back(&DirWalker::workerLoop, this);
+            }
+        }
+        
+        ~DirWalker() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            changed.notify_all();
+            for (auto& worker : workers) worker.join();
+        }
+        
+        vector<DirEntry> nextBatch(size_t maxEntries) {
+            vector<DirEntry> batch;
+            if (workers.empty()) {
+                // Sequential walk, directories are scanned on demand
+                while (ready.size() < maxEntries && !pendingDirs.empty()) {
+                    string relPath = pendingDirs.front();
+                    pendingDirs.pop_front();
+                    scanInto(relPath);
+                }
+            } else {
+                unique_lock<mutex> guard(lock);
+                wanted = maxEntries;
+                // Workers may be waiting for room under the old batch size
+                changed.notify_all();
+                changed.wait(guard, [&] { return ready.size() >= maxEntries || finished(); });
+            }
+            
+            {
+                lock_guard<mutex> guard(lock);
+                size_t count = min(maxEntries, ready.size());
+                batch.reserve(count);
+                for (size_t i = 0; i < count; i++) {
+                    batch.push_back(std::move(ready.front()));
+                    ready.pop_front();
+                }
+            }
+            // Room was made for workers waiting on a full queue
+            if (!workers.empty()) changed.notify_all();
+            return batch;
+        }
+        
+        bool done() {
+            lock_guard<mutex> guard(lock);
+            return finished() && ready.empty();
+        }
+        
+    private:
+        bool finished() const {
+            return pendingDirs.empty() && busyWorkers == 0;
+        }
+        
+        // Workers stop scanning once this many entries are waiting, so memory
+        // follows the batch size instead of the size of the tree
+        size_t readyLimit() const {
+            return READY_BATCHES * max(wanted, (size_t)1);
+        }
+        
+        // Returns how many directories were queued for scanning
+        size_t scanInto(const string& relPath) {
+            vector<DirEntry> entries;
+            vector<string> subdirs;
+            scanDirectory(root, relPath, entries, subdirs);
+            
+            lock_guard<mutex> guard(lock);
+            for (auto& entry : entries) ready.push_back(std::move(entry));
+            if (!recursive) return 0;
+            for (auto& subdir : subdirs) pendingDirs.push_back(std::move(subdir));
+            return subdirs.size();
+        }
+        
+        void workerLoop() {
+            unique_lock<mutex> guard(lock);
+            while (true) {
+                changed.wait(guard, [&] {
+                    return stopping || finished() || (!pendingDirs.empty() && ready.size() < readyLimit());
+                });
+                if (stopping || finished()) break;
+                
+                string relPath = pendingDirs.front();
+                pendingDirs.pop_front();
+                busyWorkers++;
+                guard.unlock();
+                size_t queued = scanInto(relPath);
+                guard.lock();
+                busyWorkers--;
+                // Only wake others when there is new work or the consumer can proceed
+                if (queued > 0 || finished() || ready.size() >= wanted)
+                    changed.notify_all();
+            }
+            changed.notify_all();
+        }
+        
+        static const size_t READY_BATCHES = 4;
+        
+        string root;
+        bool recursive;
+        deque<string> pendingDirs;
+        deque<DirEntry> ready;
+        vector<thread> workers;
+        mutex lock;
+        condition_variable changed;
+        size_t wanted = 0;
+        int busyWorkers = 0;
+        bool stopping = false;
+    };
+    
+    static const size_t MAX_WALK_BATCH = 1 << 20;
+    static unordered_map<int, unique_ptr<DirWalker>> openWalks;
+    static int nextWalkHandle = 1;
+    
+    int openWalk(const string& root, bool recursive, int threads) {
+        Performance::recordFunctionCall();
+        int handle = nextWalkHandle++;
+        openWalks[handle] = unique_ptr<DirWalker>(new DirWalker(root, recursive, threads));
+        return handle;
+    }
+    
+    vector<DirEntry> walkNext(int handle, size_t maxEntries) {
+        auto it = openWalks.find(handle);
+        if (it == openWalks.end()) {
+            cerr << "Invalid walk handle: " << handle << endl;
+            return {};
+        }
+        // At least one entry, so a walk always progresses, and few enough that
+        // the ready queue bound of a few batches can't overflow
+        return it->second->nextBatch(min(max(maxEntries, (size_t)1), MAX_WALK_BATCH));
+    }
+    
+    bool walkDone(int handle) {
+        auto it = openWalks.find(handle);
+        return it == openWalks.end() || it->second->done();
+    }
+    
+    bool closeWalk(int handle) {
+        return openWalks.erase(handle) > 0;
+    }
+    
+    vector<DirEntry> walkDir(const string& root, bool recursive, int threads) {
+        Performance::recordFunctionCall();
+        DirWalker walker(root, recursive, threads);
+        vector<DirEntry> entries;
+        while (!walker.done()) {
+            vector<DirEntry> batch = walker.nextBatch(4096);
+            entries.insert(entries.end(), make_move_iterator(batch.begin()), make_move_iterator(batch.end()));
+        }
+        return entries;
+    }
+    
     string getAbsolutePath(const string& path) {
 #if defined(_WIN32) || defined(_WIN64)
         char buffer[MAX_PATH];
@@ -146,9 +704,10 @@ namespace Process {
         }
         
         string result;
-        char buffer[256];
-        while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-            result += buffer;
+        char buffer[4096];
+        size_t bytesRead;
+        while ((bytesRead = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+            result.append(buffer, bytesRead);
         }
         
 #if defined(_WIN32) || defined(_WIN64)
@@ -215,6 +774,369 @@ namespace Process {
 #endif
         return info;
     }
+    
+    // Async process table, keyed by the handles given out by spawn()
+    struct AsyncProcess {
+        string command;
+        string output;
+        string error;
+        int exitCode = -1;
+        bool exited = false;
+#if defined(_WIN32) || defined(_WIN64)
+        HANDLE process = nullptr;
+        HANDLE outPipe = nullptr;
+        HANDLE errPipe = nullptr;
+#else
+        pid_t pid = -1;
+        int outFd = -1;
+        int errFd = -1;
+#endif
+    };
+    
+    static unordered_map<int, AsyncProcess> asyncProcesses;
+    static int nextProcessHandle = 1;
+    static int maxConcurrentProcesses = 0;  // 0 means unlimited
+#if !defined(_WIN32) && !defined(_WIN64)
+    // Children released while still running, reaped by pumpProcesses once they exit
+    static vector<pid_t> releasedPids;
+#endif
+    
+    static bool isFinished(const AsyncProcess& proc) {
+#if defined(_WIN32) || defined(_WIN64)
+        return proc.exited && proc.outPipe == nullptr && proc.errPipe == nullptr;
+#else
+        return proc.exited && proc.outFd == -1 && proc.errFd == -1;
+#endif
+    }
+    
+#if defined(_WIN32) || defined(_WIN64)
+    // Reads whatever is currently in the pipe without blocking, returns true if anything was read
+    static bool drainPipe(HANDLE& pipe, string& into) {
+        bool progressed = false;
+        char buffer[4096];
+        while (pipe != nullptr) {
+            DWORD available = 0;
+            if (!PeekNamedPipe(pipe, nullptr, 0, nullptr, &available, nullptr)) {
+                CloseHandle(pipe);
+                pipe = nullptr;
+                return true;
+            }
+            if (available == 0) break;
+            DWORD bytesRead = 0;
+            DWORD toRead = available < sizeof(buffer) ? available : (DWORD)sizeof(buffer);
+            if (!ReadFile(pipe, buffer, toRead, &bytesRead, nullptr) || bytesRead == 0) break;
+            into.append(buffer, bytesRead);
+            progressed = true;
+        }
+        return progressed;
+    }
+    
+    // Collects pending output of every tracked process and reaps the ones that exited
+    static void pumpProcesses(int timeoutMs) {
+        bool pending = false;
+        bool progressed = false;
+        for (auto& entry : asyncProcesses) {
+            AsyncProcess& proc = entry.second;
+            if (isFinished(proc)) continue;
+            pending = true;
+            progressed |= drainPipe(proc.outPipe, proc.output);
+            progressed |= drainPipe(proc.errPipe, proc.error);
+            if (!proc.exited && WaitForSingleObject(proc.process, 0) == WAIT_OBJECT_0) {
+                DWORD code = 0;
+                GetExitCodeProcess(proc.process, &code);
+                proc.exitCode = (int)code;
+                proc.exited = true;
+                CloseHandle(proc.process);
+                proc.process = nullptr;
+                progressed = true;
+            }
+        }
+        if (pending && !progressed && timeoutMs > 0) {
+            Sleep(1);
+        }
+    }
+    
+    static int spawnProcess(const string& cmd) {
+        SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+        HANDLE outRead, outWrite, errRead, errWrite;
+        if (!CreatePipe(&outRead, &outWrite, &sa, 0)) return -1;
+        if (!CreatePipe(&errRead, &errWrite, &sa, 0)) {
+            CloseHandle(outRead);
+            CloseHandle(outWrite);
+            return -1;
+        }
+        SetHandleInformation(outRead, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(errRead, HANDLE_FLAG_INHERIT, 0);
+        
+        STARTUPINFOA si = {0};
+        PROCESS_INFORMATION pi = {0};
+        si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = outWrite;
+        si.hStdError = errWrite;
+        
+        string cmdLine = "cmd.exe /C " + cmd;
+        bool created = CreateProcessA(nullptr, &cmdLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi) != 0;
+        CloseHandle(outWrite);
+        CloseHandle(errWrite);
+        if (!created) {
+            CloseHandle(outRead);
+            CloseHandle(errRead);
+            cerr << "Failed to spawn command: " << cmd << endl;
+            return -1;
+        }
+        CloseHandle(pi.hThread);
+        
+        AsyncProcess proc;
+        proc.command = cmd;
+        proc.process = pi.hProcess;
+        proc.outPipe = outRead;
+        proc.errPipe = errRead;
+        int handle = nextProcessHandle++;
+        asyncProcesses[handle] = proc;
+        return handle;
+    }
+#else
+    static void drainPipe(int& fd, string& into) {
+        char buffer[4096];
+        while (fd != -1) {
+            ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+            if (bytesRead > 0) {
+                into.append(buffer, bytesRead);
+            } else if (bytesRead == 0) {
+                close(fd);
+                fd = -1;
+            } else {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    close(fd);
+                    fd = -1;
+                }
+                break;
+            }
+        }
+    }
+    
+    // Collects pending output of every tracked process and reaps the ones that exited.
+    // Blocks for at most timeoutMs waiting for any pipe to become readable.
+    static void pumpProcesses(int timeoutMs) {
+        releasedPids.erase(remove_if(releasedPids.begin(), releasedPids.end(), [](pid_t pid) {
+            return waitpid(pid, nullptr, WNOHANG) != 0;
+        }), releasedPids.end());
+        
+        vector<pollfd> fds;
+        bool pending = false;
+        for (auto& entry : asyncProcesses) {
+            AsyncProcess& proc = entry.second;
+            if (isFinished(proc)) continue;
+            pending = true;
+            if (proc.outFd != -1) fds.push_back({ proc.outFd, POLLIN, 0 });
+            if (proc.errFd != -1) fds.push_back({ proc.errFd, POLLIN, 0 });
+        }
+        if (!pending) return;
+        
+        if (!fds.empty()) {
+            ::poll(fds.data(), fds.size(), timeoutMs);
+        } else if (timeoutMs > 0) {
+            usleep(1000);  // Pipes are closed, only waiting on the exit status
+        }
+        
+        for (auto& entry : asyncProcesses) {
+            AsyncProcess& proc = entry.second;
+            if (isFinished(proc)) continue;
+            drainPipe(proc.outFd, proc.output);
+            drainPipe(proc.errFd, proc.error);
+            if (!proc.exited) {
+                int status = 0;
+                if (waitpid(proc.pid, &status, WNOHANG) == proc.pid) {
+                    proc.exited = true;
+                    if (WIFEXITED(status))
+                        proc.exitCode = WEXITSTATUS(status);
+                    else if (WIFSIGNALED(status))
+                        proc.exitCode = 128 + WTERMSIG(status);
+                }
+            }
+        }
+    }
+    
+    static int spawnProcess(const string& cmd) {
+        int outPipe[2];
+        int errPipe[2];
+        if (pipe(outPipe) != 0) {
+            cerr << "Failed to spawn command: " << cmd << endl;
+            return -1;
+        }
+        if (pipe(errPipe) != 0) {
+            close(outPipe[0]);
+            close(outPipe[1]);
+            cerr << "Failed to spawn command: " << cmd << endl;
+            return -1;
+        }
+        
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(outPipe[1], STDOUT_FILENO);
+            dup2(errPipe[1], STDERR_FILENO);
+            close(outPipe[0]);
+            close(outPipe[1]);
+            close(errPipe[0]);
+            close(errPipe[1]);
+            execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr);
+            _exit(127);
+        }
+        close(outPipe[1]);
+        close(errPipe[1]);
+        if (pid < 0) {
+            close(outPipe[0]);
+            close(errPipe[0]);
+            cerr << "Failed to spawn command: " << cmd << endl;
+            return -1;
+        }
+        
+        // Read ends must not block the interpreter, nor leak into later children
+        for (int fd : { outPipe[0], errPipe[0] }) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        
+        AsyncProcess proc;
+        proc.command = cmd;
+        proc.pid = pid;
+        proc.outFd = outPipe[0];
+        proc.errFd = errPipe[0];
+        int handle = nextProcessHandle++;
+        asyncProcesses[handle] = proc;
+        return handle;
+    }
+#endif
+    
+    static AsyncProcess* findProcess(int handle) {
+        auto it = asyncProcesses.find(handle);
+        if (it == asyncProcesses.end()) {
+            cerr << "Invalid process handle: " << handle << endl;
+            return nullptr;
+        }
+        return &it->second;
+    }
+    
+    int spawn(const string& cmd) {
+        Performance::recordFunctionCall();
+        
+        // Respect the concurrency limit by collecting finished processes first
+        while (maxConcurrentProcesses > 0 && runningCount() >= maxConcurrentProcesses) {
+            pumpProcesses(50);
+        }
+        return spawnProcess(cmd);
+    }
+    
+    string readOutput(int handle) {
+        pumpProcesses(0);
+        AsyncProcess* proc = findProcess(handle);
+        if (!proc) return "";
+        string chunk;
+        chunk.swap(proc->output);
+        return chunk;
+    }
+    
+    string readError(int handle) {
+        pumpProcesses(0);
+        AsyncProcess* proc = findProcess(handle);
+        if (!proc) return "";
+        string chunk;
+        chunk.swap(proc->error);
+        return chunk;
+    }
+    
+    bool poll(int handle) {
+        pumpProcesses(0);
+        AsyncProcess* proc = findProcess(handle);
+        return proc ? isFinished(*proc) : true;
+    }
+    
+    int wait(int handle) {
+        Performance::recordFunctionCall();
+        AsyncProcess* proc = findProcess(handle);
+        if (!proc) return -1;
+        while (!isFinished(*proc)) {
+            pumpProcesses(50);
+        }
+        return proc->exitCode;
+    }
+    
+    bool release(int handle) {
+        auto it = asyncProcesses.find(handle);
+        if (it == asyncProcesses.end()) return false;
+        if (!isFinished(it->second)) {
+            // Still running, stop tracking it and let it finish on its own
+#if defined(_WIN32) || defined(_WIN64)
+            if (it->second.process) CloseHandle(it->second.process);
+            if (it->second.outPipe) CloseHandle(it->second.outPipe);
+            if (it->second.errPipe) CloseHandle(it->second.errPipe);
+#else
+            if (it->second.outFd != -1) close(it->second.outFd);
+            if (it->second.errFd != -1) close(it->second.errFd);
+            // Reaped later so it doesn't stay behind as a zombie
+            if (!it->second.exited && waitpid(it->second.pid, nullptr, WNOHANG) == 0)
+                releasedPids.push_back(it->second.pid);
+#endif
+        }
+        asyncProcesses.erase(it);
+        return true;
+    }
+    
+    void setMaxConcurrent(int limit) {
+        maxConcurrentProcesses = limit > 0 ? limit : 0;
+    }
+    
+    int runningCount() {
+        int running = 0;
+        for (const auto& entry : asyncProcesses) {
+            if (!entry.second.exited) running++;
+        }
+        return running;
+    }
+    
+    vector<ProcessResult> runConcurrent(const vector<string>& cmds, int maxConcurrent) {
+        Performance::recordFunctionCall();
+        
+        vector<ProcessResult> results(cmds.size());
+        vector<int> handles(cmds.size(), -1);
+        size_t nextCmd = 0;
+        size_t completed = 0;
+        int alive = 0;
+        
+        while (completed < cmds.size()) {
+            // Top up to the limit, which setMaxConcurrent also caps
+            while (nextCmd < cmds.size() && (maxConcurrent <= 0 || alive < maxConcurrent)
+                && (maxConcurrentProcesses <= 0 || runningCount() < maxConcurrentProcesses)) {
+                results[nextCmd].command = cmds[nextCmd];
+                results[nextCmd].exitCode = -1;
+                handles[nextCmd] = spawnProcess(cmds[nextCmd]);
+                if (handles[nextCmd] == -1)
+                    completed++;
+                else
+                    alive++;
+                nextCmd++;
+            }
+            
+            pumpProcesses(50);
+            
+            for (size_t i = 0; i < nextCmd; i++) {
+                if (handles[i] == -1) continue;
+                AsyncProcess& proc = asyncProcesses[handles[i]];
+                if (!isFinished(proc)) continue;
+                results[i].output.swap(proc.output);
+                results[i].error.swap(proc.error);
+                results[i].exitCode = proc.exitCode;
+                release(handles[i]);
+                handles[i] = -1;
+                alive--;
+                completed++;
+            }
+        }
+        return results;
+    }
 }
 
 // Environment Implementation
@@ -375,6 +1297,11 @@ namespace SystemInfo {
         if (GetDiskFreeSpaceExA(path.c_str(), &freeBytesAvailable, nullptr, nullptr)) {
             return freeBytesAvailable.QuadPart;
         }
+#else
+        struct statvfs stats;
+        if (statvfs(path.c_str(), &stats) == 0) {
+            return (long long)stats.f_bavail * stats.f_frsize;
+        }
 #endif
         return -1;
     }
@@ -420,6 +1347,208 @@ namespace Memory {
     }
 }
 
+// C++ Embedding Implementation
+namespace CppEmbedding {
+    // The source is kept beside the library, with the same name ending in .cpp
+    static string sourcePathFor(const string& outputPath) {
+        size_t slash = outputPath.find_last_of("/\\");
+        size_t dot = outputPath.find_last_of('.');
+        if (dot == string::npos || (slash != string::npos && dot < slash))
+            return outputPath + ".cpp";
+        return outputPath.substr(0, dot) + ".cpp";
+    }
+
+    bool compileCppBlock(const string& cppCode, const string& outputPath) {
+        Performance::recordFunctionCall();
+        string sourcePath = sourcePathFor(outputPath);
+        // The library left by an earlier build of the same code is reused.
+        // A failed build deletes it, so one that exists is complete
+        if (FileSystem::fileExists(outputPath)) {
+            FileSystem::MappedFile previous;
+            if (previous.open(sourcePath) && previous.view() == cppCode)
+                return true;
+        }
+        if (!FileSystem::writeAll(sourcePath, cppCode))
+            return false;
+        FileSystem::fileDelete(outputPath);
+
+        // The compiler can be picked with CXX, like in a build
+        const char* cxx = getenv("CXX");
+#if defined(_WIN32) || defined(_WIN64)
+        string compiler = cxx != nullptr ? cxx : "cl";
+        string cmd = compiler + " /nologo /LD /O2 /EHsc \"" + sourcePath + "\" /Fe:\"" + outputPath + "\"";
+#else
+        string compiler = cxx != nullptr ? cxx : "c++";
+        string cmd = compiler + " -std=c++17 -O2 -shared -fPIC \"" + sourcePath + "\" -o \"" + outputPath + "\"";
+#endif
+        string output = Process::executeCommand(cmd);
+        if (!FileSystem::fileExists(outputPath)) {
+            cerr << "Failed to compile " << sourcePath << ":" << endl << output;
+            return false;
+        }
+        return true;
+    }
+
+    void* loadDynamicLibrary(const string& path) {
+        Performance::recordFunctionCall();
+#if defined(_WIN32) || defined(_WIN64)
+        return (void*)LoadLibraryA(path.c_str());
+#else
+        // dlopen only searches the library path for bare names
+        string target = path.find('/') == string::npos ? "./" + path : path;
+        void* handle = dlopen(target.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle)
+            cerr << "Failed to load " << path << ": " << dlerror() << endl;
+        return handle;
+#endif
+    }
+
+    void unloadDynamicLibrary(void* handle) {
+        if (!handle)
+            return;
+#if defined(_WIN32) || defined(_WIN64)
+        FreeLibrary((HMODULE)handle);
+#else
+        dlclose(handle);
+#endif
+    }
+
+    void* getFunctionAddress(void* handle, const string& functionName) {
+        if (!handle)
+            return nullptr;
+#if defined(_WIN32) || defined(_WIN64)
+        return (void*)GetProcAddress((HMODULE)handle, functionName.c_str());
+#else
+        return dlsym(handle, functionName.c_str());
+#endif
+    }
+
+    // Modules stay loaded for the life of the interpreter, as scripts keep
+    // calling into them
+    static unordered_map<string, void*> loadedModules;
+    static unordered_map<string, ModuleFunction> moduleFunctions;
+
+    static string moduleFunctionName(const string& name) {
+        return name.rfind("ZS.", 0) == 0 ? name : "ZS." + name;
+    }
+
+    static int registerModuleFunction(HolyZRegistry* registry, const char* name, HolyZFunction function, int paramCount) {
+        if (!name || !*name || !function)
+            return 0;
+        string fullName = moduleFunctionName(name);
+        const string& modulePath = *static_cast<const string*>(registry->host);
+        if (moduleFunctions.count(fullName) > 0) {
+            cerr << modulePath << ": " << fullName << " is already registered by " << moduleFunctions[fullName].modulePath << endl;
+            return 0;
+        }
+        moduleFunctions[fullName] = { function, paramCount, modulePath };
+        return 1;
+    }
+
+    bool loadModule(const string& path) {
+        Performance::recordFunctionCall();
+        string modulePath = FileSystem::getAbsolutePath(path);
+        if (loadedModules.count(modulePath) > 0)
+            return true;
+
+        void* handle = loadDynamicLibrary(modulePath);
+        if (!handle)
+            return false;
+        HolyZModuleInit init = (HolyZModuleInit)getFunctionAddress(handle, HOLYZ_MODULE_INIT_NAME);
+        if (!init) {
+            cerr << modulePath << " is not a Holy Z module, it has no " << HOLYZ_MODULE_INIT_NAME << endl;
+            unloadDynamicLibrary(handle);
+            return false;
+        }
+
+        HolyZRegistry registry = { HOLYZ_MODULE_ABI_VERSION, registerModuleFunction, &modulePath };
+        if (init(&registry) == 0) {
+            // Forget whatever it registered before refusing
+            for (auto it = moduleFunctions.begin(); it != moduleFunctions.end();)
+                it = it->second.modulePath == modulePath ? moduleFunctions.erase(it) : next(it);
+            unloadDynamicLibrary(handle);
+            return false;
+        }
+        loadedModules[modulePath] = handle;
+        return true;
+    }
+
+    const ModuleFunction* findModuleFunction(const string& name) {
+        if (moduleFunctions.empty())
+            return nullptr;
+        auto it = moduleFunctions.find(name);
+        return it != moduleFunctions.end() ? &it->second : nullptr;
+    }
+
+    boost::any callModuleFunction(const string& name, const ModuleFunction& function, const vector<boost::any>& args) {
+        Performance::recordFunctionCall();
+        if (function.paramCount >= 0 && (int)args.size() != function.paramCount) {
+            cerr << name << " takes " << function.paramCount << " arguments, got " << args.size() << endl;
+            return boost::any();
+        }
+
+        // Numbers are passed as they are, and so is text that reads as one, as
+        // number literals are stored as their text. Other strings are passed
+        // in place, unless they still carry their quotes
+        vector<HolyZValue> values(args.size());
+        vector<string> unquoted;
+        unquoted.reserve(args.size());
+        for (size_t i = 0; i < args.size(); i++) {
+            const boost::any& arg = args[i];
+            if (arg.type() == typeid(int))
+                values[i] = holyz_int(boost::any_cast<int>(arg));
+            else if (arg.type() == typeid(float))
+                values[i] = holyz_float(boost::any_cast<float>(arg));
+            else if (arg.type() == typeid(bool))
+                values[i] = holyz_bool(boost::any_cast<bool>(arg));
+            else if (arg.type() == typeid(string)) {
+                const string* text = boost::any_cast<string>(&arg);
+                size_t start = !text->empty() && (*text)[0] == '-' ? 1 : 0;
+                if (text->size() > start && text->compare(start, string::npos, ".") != 0 && isNumber(text->substr(start))) {
+                    long long whole = text->find('.') == string::npos && text->size() - start <= 10 ? stoll(*text) : (long long)INT_MAX + 1;
+                    if (whole >= INT_MIN && whole <= INT_MAX)
+                        values[i] = holyz_int((int)whole);
+                    else
+                        values[i] = holyz_float(strtof(text->c_str(), nullptr));
+                    continue;
+                }
+                if (!text->empty() && (*text)[0] == '\"') {
+                    unquoted.push_back(StringRaw(*text));
+                    text = &unquoted.back();
+                }
+                values[i] = holyz_string(text->data(), text->size());
+            }
+            else
+                values[i] = holyz_null();
+        }
+
+        HolyZValue result = function.function(values.data(), values.size());
+        switch (result.type) {
+        case HOLYZ_INT:
+            return result.as.i;
+        case HOLYZ_FLOAT:
+            return result.as.f;
+        case HOLYZ_BOOL:
+            return result.as.b != 0;
+        case HOLYZ_STRING:
+            return result.as.s.data ? string(result.as.s.data, result.as.s.length) : string();
+        default:
+            return boost::any();
+        }
+    }
+
+    boost::any executeCompiledCpp(const string& modulePath, const string& functionName, const vector<boost::any>& args) {
+        if (!loadModule(modulePath))
+            return boost::any();
+        const ModuleFunction* function = findModuleFunction(moduleFunctionName(functionName));
+        if (!function) {
+            cerr << modulePath << " has no function " << functionName << endl;
+            return boost::any();
+        }
+        return callModuleFunction(moduleFunctionName(functionName), *function, args);
+    }
+}
+
 // Identifier Map Implementation
 void IdentifierMap::insert(const string& identifier, const boost::any& value) {
     string normalized = identifier;
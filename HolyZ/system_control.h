@@ -7,6 +7,10 @@
 #include <fstream>
 #include <cstdlib>
 #include <chrono>
+#include <string_view>
+#include <cstdio>
+
+#include "holyz_module.h"
 
 using namespace std;
 
@@ -16,12 +20,103 @@ using namespace std;
 
 // File System Operations
 namespace FileSystem {
+    // Read-only memory mapping of a whole file. The view stays valid for the
+    // lifetime of the object, so contents can be processed in place. Pipes,
+    // devices and files reporting a size of 0 (like those in /proc) can't be
+    // mapped, so they are read into memory instead.
+    class MappedFile {
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const string& path) { open(path); }
+        ~MappedFile() { close(); }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        bool open(const string& path);
+        void close();
+        bool isOpen() const { return opened; }
+        const char* data() const { return mapped; }
+        size_t size() const { return length; }
+        string_view view() const { return string_view(mapped, length); }
+
+    private:
+        const char* mapped = nullptr;
+        size_t length = 0;
+        bool opened = false;
+        // Contents of a file that was read instead of mapped
+        bool copied = false;
+        string contents;
+#if defined(_WIN32) || defined(_WIN64)
+        void* fileHandle = nullptr;
+        void* mappingHandle = nullptr;
+#endif
+    };
+
+    // Buffered sequential file access over one large aligned buffer. A stream
+    // is opened either for reading ("r") or for writing ("w", "a").
+    class FileStream {
+    public:
+        static const size_t bufferSize = 1 << 20;
+
+        FileStream() = default;
+        ~FileStream() { close(); }
+        FileStream(const FileStream&) = delete;
+        FileStream& operator=(const FileStream&) = delete;
+
+        bool open(const string& path, const string& mode);
+        void close();
+        bool isOpen() const { return file != nullptr; }
+        bool readLine(string& line);
+        string readChunk(size_t count);
+        bool write(string_view data);
+        bool flush();
+        bool endOfFile();
+
+    private:
+        bool fill();
+
+        FILE* file = nullptr;
+        char* buffer = nullptr;
+        size_t bufferStart = 0;
+        size_t bufferEnd = 0;
+        bool writing = false;
+        bool reachedEnd = false;
+    };
+
+    // Streams handed to scripts are referenced by handle
+    int openStream(const string& path, const string& mode);
+    FileStream* getStream(int handle);
+    bool closeStream(int handle);
+
+    // Writes the whole content with a single open and write
+    bool writeAll(const string& path, string_view content);
+
     string fileRead(const string& path);
     bool fileWrite(const string& path, const string& content);
     bool fileDelete(const string& path);
     bool fileExists(const string& path);
     vector<string> listDir(const string& path);
     string getAbsolutePath(const string& path);
+
+    // Directory walking with metadata. Paths are relative to the walk root and
+    // use '/' as separator. Symbolic links are reported but never followed.
+    struct DirEntry {
+        string path;
+        long long size;
+        long long modifiedTime;  // Seconds since the epoch
+        char type;               // 'f' file, 'd' directory, 'l' link, 'o' other
+    };
+
+    // Walks are read in batches through a handle. With threads > 1, subtrees
+    // are scanned in parallel in the background while batches are consumed.
+    // walkNext returns between 1 and 2^20 entries per batch until the walk is done.
+    int openWalk(const string& root, bool recursive = true, int threads = 1);
+    vector<DirEntry> walkNext(int handle, size_t maxEntries);
+    bool walkDone(int handle);
+    bool closeWalk(int handle);
+    vector<DirEntry> walkDir(const string& root, bool recursive = true, int threads = 1);
 }
 
 // Process Control
@@ -30,6 +125,28 @@ namespace Process {
     int executeAsync(const string& cmd);
     bool killProcess(int pid);
     vector<string> getProcessInfo(int pid);
+
+    // Non-blocking execution: spawn() starts a command with piped stdout/stderr
+    // and returns a handle. Output is collected in the background of every call
+    // into this API, and stays readable until release() frees the handle.
+    struct ProcessResult {
+        string command;
+        string output;
+        string error;
+        int exitCode;
+    };
+
+    int spawn(const string& cmd);
+    string readOutput(int handle);
+    string readError(int handle);
+    bool poll(int handle);
+    int wait(int handle);
+    bool release(int handle);
+    void setMaxConcurrent(int limit);
+    int runningCount();
+
+    // Runs every command with at most maxConcurrent alive at once, results are in input order
+    vector<ProcessResult> runConcurrent(const vector<string>& cmds, int maxConcurrent);
 }
 
 // Environment Variables
@@ -68,7 +185,8 @@ namespace Memory {
 // ============================================================
 
 namespace CppEmbedding {
-    // Embed and execute C++ code
+    // Embed and execute C++ code. compileCppBlock skips the compiler when
+    // outputPath was already built from the same code
     bool compileCppBlock(const string& cppCode, const string& outputPath);
     boost::any executeCompiledCpp(const string& modulePath, const string& functionName, 
                                   const vector<boost::any>& args);
@@ -77,6 +195,19 @@ namespace CppEmbedding {
     void* loadDynamicLibrary(const string& path);
     void unloadDynamicLibrary(void* handle);
     void* getFunctionAddress(void* handle, const string& functionName);
+
+    // Native extension modules (see holyz_module.h). Functions are registered
+    // under "ZS.<name>" and called through ZSFunction
+    struct ModuleFunction {
+        HolyZFunction function;
+        int paramCount;          // -1 for any number of arguments
+        string modulePath;
+    };
+
+    // Loads a module once and runs its holyz_module_init
+    bool loadModule(const string& path);
+    const ModuleFunction* findModuleFunction(const string& name);
+    boost::any callModuleFunction(const string& name, const ModuleFunction& function, const vector<boost::any>& args);
 }
 
 // ============================================================
@@ -116,7 +247,7 @@ public:
 // Enhanced Error Handling
 // ============================================================
 
-class HolyZException : public exception {
+class HolyZException : public std::exception {
     string message;
     int lineNumber;
     string context;
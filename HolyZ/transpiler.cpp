@@ -0,0 +1,541 @@
+// transpiler.cpp - Translation of script functions to C++ for --emit-cpp
+
+#include "transpiler.h"
+#include "strops.h"
+#include <algorithm>
+#include <cctype>
+#include <map>
+
+namespace Transpiler {
+	static const unordered_map<string, string> mathFunctions = {
+		{ "ZS.Math.Sin", "std::sin" },
+		{ "ZS.Math.Cos", "std::cos" },
+		{ "ZS.Math.Tan", "std::tan" },
+		{ "ZS.Math.Abs", "std::fabs" },
+	};
+
+	static const vector<string> numberTypes = { "int", "float", "bool", "I8", "U8", "I16", "U16", "I32", "U32", "I64", "U64", "F64" };
+	static const vector<string> integerTypes = { "int", "I8", "U8", "I16", "U16", "I32", "U32", "I64", "U64" };
+
+	string entryPointName(const string& function) {
+		return "holyz_aot_" + function;
+	}
+
+	static bool isIdentifier(const string& name) {
+		if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+			return false;
+		for (char c : name)
+			if (!isalnum((unsigned char)c) && c != '_')
+				return false;
+		return true;
+	}
+
+	struct Signature {
+		vector<string> params;
+		bool returnsValue = false;
+		string returnType;  // "int" or "float", once resolved
+	};
+
+	// State of the function being translated
+	struct Context {
+		const Signature* signature;
+		const map<string, Signature>* functions;
+		unordered_map<string, string> locals;   // Name -> C++ type
+		vector<string> returns;                 // "int", "float" or "call <function>" per return
+		string error;
+		int depth = 1;
+
+		bool isVariable(const string& name) const {
+			return locals.count(name) > 0 || find(signature->params.begin(), signature->params.end(), name) != signature->params.end();
+		}
+
+		bool isIntegerLocal(const string& name) const {
+			auto local = locals.find(name);
+			return local != locals.end() && find(integerTypes.begin(), integerTypes.end(), local->second) != integerTypes.end();
+		}
+
+		bool fail(const string& reason) {
+			if (error.empty())
+				error = reason;
+			return false;
+		}
+	};
+
+	// Translates an arithmetic expression, checking that it is well formed
+	// so the generated file always compiles. voidCall allows the expression
+	// to be a call to a function without a return value. Like evaluate(),
+	// the expression computes with floating point whatever its operands'
+	// types: numbers and locals are read as doubles, so '/' never divides
+	// as ints and dividing by 0 gives inf or NaN instead of trapping. Forms
+	// evaluate() reads differently from C++ are rejected, as in the JIT: a '-'
+	// following a parenthesized group, and a unary minus on anything but a
+	// number literal
+	static bool expression(const string& text, Context& context, string& out, bool voidCall = false) {
+		struct Frame {
+			bool call;
+			size_t expected;
+			size_t commas;
+		};
+		vector<Frame> frames;
+		bool expectOperand = true;
+		bool closedGroup = false;
+		out.clear();
+
+		for (size_t i = 0; i < text.size();) {
+			char c = text[i];
+			if (c == ' ') {
+				i++;
+				continue;
+			}
+			bool afterGroup = closedGroup;
+			closedGroup = false;
+			if (isdigit((unsigned char)c) || (c == '.' && i + 1 < text.size() && isdigit((unsigned char)text[i + 1]))) {
+				if (!expectOperand)
+					return context.fail("malformed expression '" + text + "'");
+				size_t start = i;
+				while (i < text.size() && (isdigit((unsigned char)text[i]) || text[i] == '.'))
+					i++;
+				string number = text.substr(start, i - start);
+				if (count(number.begin(), number.end(), '.') > 1)
+					return context.fail("malformed number '" + number + "'");
+				out += number.find('.') == string::npos ? number + ".0" : number;
+				expectOperand = false;
+			}
+			else if (isalpha((unsigned char)c) || c == '_') {
+				if (!expectOperand)
+					return context.fail("malformed expression '" + text + "'");
+				size_t start = i;
+				while (i < text.size() && (isalnum((unsigned char)text[i]) || text[i] == '_' || text[i] == '.'))
+					i++;
+				string name = text.substr(start, i - start);
+				size_t next = i;
+				while (next < text.size() && text[next] == ' ')
+					next++;
+
+				if (next < text.size() && text[next] == '(') {
+					auto math = mathFunctions.find(name);
+					auto function = context.functions->find(name);
+					if (math != mathFunctions.end()) {
+						out += math->second + "(";
+						frames.push_back({ true, 1, 0 });
+					}
+					else if (function != context.functions->end()) {
+						if (!function->second.returnsValue && !(voidCall && start == 0))
+							return context.fail("uses the value of " + name + ", which returns nothing");
+						out += "hz_" + name + "(";
+						frames.push_back({ true, function->second.params.size(), 0 });
+					}
+					else
+						return context.fail("calls " + name + ", which isn't native");
+					i = next + 1;
+					continue; // expects the first argument
+				}
+				if (name == "true" || name == "false")
+					out += name == "true" ? "1.0" : "0.0";
+				else if (context.locals.count(name) > 0 && context.locals.at(name) != "F64")
+					out += "(double)v_" + name;
+				else if (context.isVariable(name))
+					out += "v_" + name;
+				else
+					return context.fail("uses '" + name + "', which isn't a parameter or local");
+				expectOperand = false;
+			}
+			else if (c == '(') {
+				if (!expectOperand)
+					return context.fail("malformed expression '" + text + "'");
+				frames.push_back({ false, 0, 0 });
+				out += c;
+				i++;
+			}
+			else if (c == ')') {
+				if (frames.empty())
+					return context.fail("unbalanced parenthesis in '" + text + "'");
+				Frame frame = frames.back();
+				frames.pop_back();
+				bool closesEmptyCall = frame.call && frame.commas == 0 && expectOperand && out.back() == '(';
+				if (expectOperand && !closesEmptyCall)
+					return context.fail("malformed expression '" + text + "'");
+				if (frame.call && (closesEmptyCall ? 0 : frame.commas + 1) != frame.expected)
+					return context.fail("passes the wrong number of arguments in '" + text + "'");
+				out += c;
+				expectOperand = false;
+				closedGroup = !frame.call;
+				i++;
+			}
+			else if (c == ',') {
+				if (frames.empty() || !frames.back().call || expectOperand)
+					return context.fail("malformed expression '" + text + "'");
+				frames.back().commas++;
+				out += ", ";
+				expectOperand = true;
+				i++;
+			}
+			else if (c == '+' || c == '-' || c == '*' || c == '/') {
+				if (c == '-' && afterGroup)
+					return context.fail("subtracts from a parenthesized group in '" + text + "'");
+				if (expectOperand) {
+					// Only a number literal may be negated
+					size_t next = i + 1;
+					while (next < text.size() && text[next] == ' ')
+						next++;
+					if (c != '-' || next >= text.size() || !isdigit((unsigned char)text[next]))
+						return context.fail("malformed expression '" + text + "'");
+					out += c;
+					i = next;
+					continue; // expects the number
+				}
+				out += string(" ") + c + " ";
+				expectOperand = true;
+				i++;
+			}
+			else if (c == '\"' || c == '\'')
+				return context.fail("uses strings");
+			else
+				return context.fail("uses '" + string(1, c) + "'");
+		}
+
+		if (!frames.empty())
+			return context.fail("unbalanced parenthesis in '" + text + "'");
+		if (expectOperand)
+			return context.fail("malformed expression '" + text + "'");
+		return true;
+	}
+
+	static string indent(int depth) {
+		return string(depth, '\t');
+	}
+
+	// The "a comparer b" of an if or while line, gathered like ProcessLine
+	// does. Sets opensBlock if the line ends with '{'
+	static bool condition(const vector<string>& line, Context& context, string& out, bool& opensBlock) {
+		vector<string> parameters;
+		opensBlock = false;
+		for (size_t w = 1; w < line.size(); w++) {
+			if (line[w].find('{') == string::npos)
+				parameters.push_back(line[w]);
+			else {
+				parameters.push_back(replace(line[w], "{", ""));
+				opensBlock = true;
+				if (w + 1 != line.size())
+					return context.fail("has code after '{'");
+				break;
+			}
+		}
+		if (!parameters.empty() && parameters.back().empty())
+			parameters.pop_back();
+		if (parameters.size() != 3)
+			return context.fail("has a condition that isn't 'a comparer b'");
+
+		const string& comparer = parameters[1];
+		if (comparer != "==" && comparer != "!=" && comparer != "<" && comparer != ">" && comparer != "<=" && comparer != ">=")
+			return context.fail("compares with '" + comparer + "'");
+
+		string lhs, rhs;
+		if (!expression(parameters[0], context, lhs) || !expression(parameters[2], context, rhs))
+			return false;
+		out = "(" + lhs + " " + comparer + " " + rhs + ")";
+		return true;
+	}
+
+	// "v_name = value;", converting like a declaration in the interpreter
+	// when the local holds an int
+	static string store(const string& name, const string& value, Context& context) {
+		if (context.isIntegerLocal(name))
+			return "v_" + name + " = hz_int<" + context.locals.at(name) + ">(" + value + ");\n";
+		return "v_" + name + " = " + value + ";\n";
+	}
+
+	// Records the type the interpreter returns text as: a lone local keeps its
+	// declared type, a lone call returns what the callee does, a whole number
+	// reads as an int and any other arithmetic gives a float
+	static bool returnType(const string& text, Context& context) {
+		if (context.locals.count(text) > 0) {
+			if (context.locals.at(text) == "bool")
+				return context.fail("returns a bool local");
+			context.returns.push_back(context.isIntegerLocal(text) ? "int" : "float");
+			return true;
+		}
+		if (context.isVariable(text))
+			return context.fail("returns the parameter '" + text + "', which keeps the caller's type");
+
+		size_t digits = text.find_first_not_of("0123456789", text[0] == '-' ? 1 : 0);
+		if (digits == string::npos) {
+			context.returns.push_back("int");
+			return true;
+		}
+		if (text.find_first_not_of("-.0123456789") == string::npos)
+			return context.fail("returns the number " + text + ", which the interpreter returns as text");
+
+		// A lone call: its first '(' is only closed by the last character
+		size_t open = text.find('(');
+		if (open != string::npos && text.back() == ')' && isIdentifier(trim(text.substr(0, open)))) {
+			int depth = 0;
+			size_t close = open;
+			for (; close < text.size(); close++) {
+				depth += text[close] == '(' ? 1 : text[close] == ')' ? -1 : 0;
+				if (depth == 0)
+					break;
+			}
+			if (close == text.size() - 1) {
+				context.returns.push_back("call " + trim(text.substr(0, open)));
+				return true;
+			}
+		}
+		context.returns.push_back("float");
+		return true;
+	}
+
+	// The type a function returns, following lone calls. Calls back into a
+	// function being resolved add nothing, and returns that disagree give
+	// "mixed"
+	static string resolveReturnType(const string& name, const map<string, vector<string>>& returns, map<string, string>& resolved) {
+		auto known = resolved.find(name);
+		if (known != resolved.end())
+			return known->second;
+		resolved[name] = "";
+		string type;
+		for (const string& entry : returns.at(name)) {
+			string entryType = startsWith(entry, "call ") ? resolveReturnType(entry.substr(5), returns, resolved) : entry;
+			if (entryType.empty())
+				continue;
+			if (!type.empty() && entryType != type) {
+				type = "mixed";
+				break;
+			}
+			type = entryType;
+		}
+		resolved[name] = type;
+		return type;
+	}
+
+	static bool statement(const vector<string>& line, Context& context, string& out) {
+		const string first = line.at(0);
+		const string keyword = toLower(first);
+		string value;
+
+		if (line.size() == 1 && first == "{") {
+			out += indent(context.depth++) + "{\n";
+			return true;
+		}
+		if (line.size() == 1 && first == "}") {
+			if (context.depth <= 1)
+				return context.fail("has unbalanced brackets");
+			out += indent(--context.depth) + "}\n";
+			return true;
+		}
+		if (keyword == "return") {
+			if (line.size() == 1) {
+				out += indent(context.depth) + (context.signature->returnsValue ? "return 0;\n" : "return;\n");
+				return true;
+			}
+			string returned = trim(unWrapVec(vector<string>(line.begin() + 1, line.end())));
+			if (!expression(returned, context, value) || !returnType(returned, context))
+				return false;
+			out += indent(context.depth) + "return (double)(" + value + ");\n";
+			return true;
+		}
+		if ((keyword == "break" || keyword == "continue") && line.size() == 1) {
+			out += indent(context.depth) + keyword + ";\n";
+			return true;
+		}
+		if (keyword == "if" || keyword == "while") {
+			bool opensBlock;
+			if (!condition(line, context, value, opensBlock))
+				return false;
+			out += indent(context.depth) + keyword + " " + value + "\n";
+			if (opensBlock)
+				out += indent(context.depth++) + "{\n";
+			return true;
+		}
+		if (keyword == "else") {
+			if (line.size() > 2 || (line.size() == 2 && line[1] != "{"))
+				return context.fail("uses 'else " + line[1] + "'");
+			out += indent(context.depth) + "else\n";
+			if (line.size() == 2)
+				out += indent(context.depth++) + "{\n";
+			return true;
+		}
+		if (find(numberTypes.begin(), numberTypes.end(), first) != numberTypes.end()) {
+			// Declarations were collected up front, what is left is the assignment
+			if (!expression(unWrapVec(vector<string>(line.begin() + 3, line.end())), context, value))
+				return false;
+			out += indent(context.depth) + store(line[1], value, context);
+			return true;
+		}
+		if (line.size() >= 3 && context.isVariable(first)) {
+			const string& op = line[1];
+			if (op != "=" && op != "+=" && op != "-=" && op != "*=" && op != "/=")
+				return context.fail("assigns with '" + op + "'");
+			// The interpreter keeps the type a variable holds through op=, and
+			// a parameter holds whatever the caller passed
+			if (op != "=" && context.locals.count(first) == 0)
+				return context.fail("updates the parameter '" + first + "' with " + op);
+			if (!expression(unWrapVec(vector<string>(line.begin() + 2, line.end())), context, value))
+				return false;
+			if (op == "=")
+				out += indent(context.depth) + store(first, value, context);
+			else if (context.isIntegerLocal(first))
+				out += indent(context.depth) + store(first, "(double)v_" + first + " " + op[0] + " (" + value + ")", context);
+			else
+				out += indent(context.depth) + "v_" + first + " " + op + " " + value + ";\n";
+			return true;
+		}
+
+		// A call on its own
+		string text = unWrapVec(line);
+		if (text.find('(') != string::npos && text.back() == ')') {
+			if (!expression(text, context, value, true))
+				return false;
+			out += indent(context.depth) + value + ";\n";
+			return true;
+		}
+		return context.fail("has the line '" + text + "', which isn't native");
+	}
+
+	// Declares every local up front, as the interpreter keeps locals for the
+	// whole function no matter where they are declared
+	static bool declareLocals(const vector<vector<string>>& lines, const vector<string>& typeNames, Context& context, string& out) {
+		for (size_t l = 1; l < lines.size(); l++) {
+			const vector<string>& line = lines[l];
+			if (line.empty() || countInVector(typeNames, line[0]) == 0)
+				continue;
+			if (find(numberTypes.begin(), numberTypes.end(), line[0]) == numberTypes.end())
+				return context.fail("declares a " + line[0] + " local");
+			if (line.size() < 4 || line[2] != "=")
+				return context.fail("declares " + unWrapVec(line) + " without a value");
+			const string& name = line[1];
+			if (!isIdentifier(name) || (context.isVariable(name) && context.locals[name] != line[0]))
+				return context.fail("declares '" + name + "' more than once, or over a parameter");
+			if (context.locals.count(name) == 0)
+				out += indent(1) + line[0] + " v_" + name + " = 0;\n";
+			context.locals[name] = line[0];
+		}
+		return true;
+	}
+
+	static bool translate(const vector<vector<string>>& lines, const vector<string>& typeNames, Context& context, string& body) {
+		if (!declareLocals(lines, typeNames, context, body))
+			return false;
+		// The function's own '{' is kept when it is on a line of its own, but
+		// its closing bracket isn't
+		size_t first = lines.size() > 1 && unWrapVec(lines[1]) == "{" ? 2 : 1;
+		for (size_t l = first; l < lines.size(); l++) {
+			bool blank = all_of(lines[l].begin(), lines[l].end(), [](const string& word) { return word.empty(); });
+			if (!blank && !statement(lines[l], context, body))
+				return false;
+		}
+		if (context.depth != 1)
+			return context.fail("has unbalanced brackets");
+		if (context.signature->returnsValue)
+			body += indent(1) + "return 0;\n";
+		return true;
+	}
+
+	static string prototype(const string& name, const Signature& signature) {
+		string text = string("static ") + (signature.returnsValue ? "double" : "void") + " hz_" + name + "(";
+		for (size_t i = 0; i < signature.params.size(); i++)
+			text += (i > 0 ? ", " : "") + string("double v_") + signature.params[i];
+		return text + ")";
+	}
+
+	Result transpile(const unordered_map<string, vector<vector<string>>>& functions, const vector<string>& typeNames, const string& header) {
+		Result result;
+
+		// Start from every function with a usable name and parameters, then
+		// drop the ones that don't translate until the set is stable, as a
+		// function can only call functions that are translated too
+		map<string, Signature> candidates;
+		for (const auto& function : functions) {
+			Signature signature;
+			for (const string& param : function.second.at(0))
+				if (!param.empty())
+					signature.params.push_back(param);
+			bool usable = isIdentifier(function.first) && all_of(signature.params.begin(), signature.params.end(), isIdentifier);
+			if (!usable) {
+				result.skipped.push_back({ function.first, "has a name or parameter that isn't a C++ identifier" });
+				continue;
+			}
+			for (size_t l = 1; l < function.second.size(); l++)
+				if (function.second[l].size() > 1 && toLower(function.second[l][0]) == "return")
+					signature.returnsValue = true;
+			candidates[function.first] = signature;
+		}
+
+		map<string, string> bodies;
+		for (bool changed = true; changed;) {
+			changed = false;
+			bodies.clear();
+			map<string, vector<string>> returns;
+			for (auto it = candidates.begin(); it != candidates.end();) {
+				Context context;
+				context.signature = &it->second;
+				context.functions = &candidates;
+				string body;
+				if (translate(functions.at(it->first), typeNames, context, body)) {
+					bodies[it->first] = body;
+					returns[it->first] = context.returns;
+					++it;
+				}
+				else {
+					result.skipped.push_back({ it->first, context.error });
+					it = candidates.erase(it);
+					changed = true;
+				}
+			}
+			if (changed)
+				continue;
+
+			// The result is converted to the type the interpreter would
+			// return, so every return of a function must agree on it
+			map<string, string> resolved;
+			for (auto it = candidates.begin(); it != candidates.end();) {
+				it->second.returnType = resolveReturnType(it->first, returns, resolved);
+				if (it->second.returnsValue && (it->second.returnType.empty() || it->second.returnType == "mixed")) {
+					result.skipped.push_back({ it->first, "returns values of different types" });
+					it = candidates.erase(it);
+					changed = true;
+				}
+				else
+					++it;
+			}
+		}
+
+		string& source = result.source;
+		source += "// Native code for " + header + "\n";
+		source += "// Generated by HolyZ --emit-cpp, changes are overwritten\n\n";
+		source += "#include <cmath>\n#include <cstdint>\n#include <limits>\n\n";
+		source += "#if defined(_WIN32)\n#define HOLYZ_EXPORT extern \"C\" __declspec(dllexport)\n";
+		source += "#else\n#define HOLYZ_EXPORT extern \"C\" __attribute__((visibility(\"default\")))\n#endif\n\n";
+		source += "typedef int8_t I8;\ntypedef uint8_t U8;\ntypedef int16_t I16;\ntypedef uint16_t U16;\n";
+		source += "typedef int32_t I32;\ntypedef uint32_t U32;\ntypedef int64_t I64;\ntypedef uint64_t U64;\ntypedef double F64;\n\n";
+		source += "// Truncates like the interpreter's int conversion: out of range values\n";
+		source += "// saturate and NaN becomes 0, where a plain cast would be undefined\n";
+		source += "template <typename T> static T hz_int(double value)\n{\n";
+		source += "\tif (value != value)\n\t\treturn 0;\n";
+		source += "\tif (value >= (double)std::numeric_limits<T>::max())\n\t\treturn std::numeric_limits<T>::max();\n";
+		source += "\tif (value <= (double)std::numeric_limits<T>::lowest())\n\t\treturn std::numeric_limits<T>::lowest();\n";
+		source += "\treturn (T)value;\n}\n\n";
+
+		for (const auto& candidate : candidates)
+			source += prototype(candidate.first, candidate.second) + ";\n";
+
+		for (const auto& candidate : candidates)
+			source += "\n" + prototype(candidate.first, candidate.second) + "\n{\n" + bodies[candidate.first] + "}\n";
+
+		for (const auto& candidate : candidates) {
+			const Signature& signature = candidate.second;
+			string call = "hz_" + candidate.first + "(";
+			for (size_t i = 0; i < signature.params.size(); i++)
+				call += (i > 0 ? ", " : "") + string("args[") + to_string(i) + "]";
+			call += ")";
+			source += "\nHOLYZ_EXPORT double " + entryPointName(candidate.first) + "(const double* args)\n{\n";
+			if (signature.params.empty())
+				source += "\t(void)args;\n";
+			source += signature.returnsValue ? "\treturn " + call + ";\n" : "\t" + call + ";\n\treturn 0;\n";
+			source += "}\n";
+
+			result.functions.push_back({ candidate.first, signature.params.size(), signature.returnsValue, signature.returnType });
+		}
+		return result;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef TRANSPILER_H
+#define TRANSPILER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+// Ahead-of-time translation of script functions to C++, used by --emit-cpp.
+// A function is translated when it stays inside the native subset:
+//   - parameters, and locals declared with int, float, bool or a Holy C
+//     number type (I8 ... U64, F64)
+//   - assignments (= += -= *= /=), if/else, while, break, continue, return
+//   - + - * / arithmetic, a comparer b conditions, Sin/Cos/Tan/Abs from
+//     ZS.Math and calls to other translated functions
+// Arithmetic is done in F64, so / is float division as in the interpreter.
+// Locals hold their declared type, and an int local converts what it is
+// assigned the way an int declaration does. Parameters are F64. Results are
+// returned as F64 along with the type the interpreter would return them as,
+// which every return of a function must agree on. Every other function stays
+// interpreted.
+namespace Transpiler {
+	struct Function {
+		string name;
+		size_t paramCount;
+		bool returnsValue;
+		string returnType;  // "int" or "float" when it returns a value
+	};
+
+	struct Result {
+		string source;                          // C++ translation unit
+		vector<Function> functions;             // Functions it exports
+		vector<pair<string, string>> skipped;   // Functions left out, and why
+	};
+
+	// Exported C entry point of a translated function. Arguments are passed
+	// in order, the result is 0 for functions without a return value
+	typedef double (*EntryPoint)(const double* args);
+	string entryPointName(const string& function);
+
+	// functions maps names to their lines, the first line holding the
+	// parameters. typeNames are the declaration keywords of the language
+	Result transpile(const unordered_map<string, vector<vector<string>>>& functions, const vector<string>& typeNames, const string& header);
+}
+
+#endif
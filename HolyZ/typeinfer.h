@@ -0,0 +1,639 @@
+#ifndef TYPEINFER_H
+#define TYPEINFER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <climits>
+#include <unordered_map>
+#include <boost/any.hpp>
+
+#include "strops.h"
+#include "main.h"
+#include "anyops.h"
+#include "optimizer.h"
+
+using namespace std;
+
+// Static typing pass over the script functions, run on each function right
+// after the optimizer. Locals declared with a number type are typed as
+// declared: int and I8 ... U64 as int, float and F64 as float. At --opt-level
+// 2, parameters without a type take the type every call site passes them.
+// Arithmetic made only of int names and whole number literals is parsed once
+// into a tree that runs with int operations, instead of being turned into
+// text and handed to evaluate() on every run.
+// The tree computes exactly what evaluate() would:
+//   - + - * on two ints is int math, / is float division like before
+//   - evaluate() works in float, which is exact for whole numbers up to 2^24,
+//     so a value past that makes the expression run as text instead
+//   - the result is a float, as evaluate()'s is, unless a declaration
+//     converts it to its type, which it does at every --opt-level
+//   - a typed name that holds something else at run time (a parameter that
+//     was passed a string, a local assigned a float) also makes the
+//     expression run as text, so a wrong guess only costs speed
+// Float names and literals aren't typed: as text they are rounded to six
+// decimals and read back by evaluate()'s own parser, which a float tree
+// wouldn't reproduce. The program refers to typed expressions as
+// "#typed<index>".
+
+enum class StaticType { Dynamic, Int, Float };
+
+struct TypedNode
+{
+	char op; // 'v' variable, 'c' constant, '~' int to float, or + - * /
+	StaticType type;
+	string name;
+	int intValue = 0;
+	float floatValue = 0;
+	unique_ptr<TypedNode> left;
+	unique_ptr<TypedNode> right;
+};
+
+struct TypedExpression
+{
+	string text;           // Source, evaluated as is when the tree can't be used
+	StaticType storeType;  // Type the result is converted to, if converting
+	bool converts;
+	unique_ptr<TypedNode> root; // Null if the expression couldn't be typed
+};
+
+vector<TypedExpression> typedExpressions;
+
+StaticType StaticTypeOf(const string& typeName)
+{
+	if (typeName == "int" || typeName == "I8" || typeName == "U8" || typeName == "I16" || typeName == "U16"
+		|| typeName == "I32" || typeName == "U32" || typeName == "I64" || typeName == "U64")
+		return StaticType::Int;
+	if (typeName == "float" || typeName == "F64")
+		return StaticType::Float;
+	return StaticType::Dynamic;
+}
+
+// Value a declaration of the given type stores. Numbers become int or float,
+// anything else is kept as is
+boost::any ToDeclaredType(StaticType type, const boost::any& value)
+{
+	if (type == StaticType::Dynamic || !IsNumericValue(value))
+		return value;
+	if (type == StaticType::Int)
+		return value.type() == typeid(int) ? value : boost::any(AnyAsInt(value));
+	return value.type() == typeid(float) ? value : boost::any(AnyAsFloat(value));
+}
+
+bool IsIntegerText(const string& text)
+{
+	size_t start = !text.empty() && text[0] == '-' ? 1 : 0;
+	if (text.size() == start || text.size() - start > 10)
+		return false;
+	for (size_t i = start; i < text.size(); i++)
+		if (!isdigit(text[i]))
+			return false;
+	return stoll(text) >= INT_MIN && stoll(text) <= INT_MAX;
+}
+
+StaticType StaticTypeOfValue(const boost::any& value)
+{
+	if (value.type() == typeid(int))
+		return StaticType::Int;
+	if (value.type() == typeid(float))
+		return StaticType::Float;
+	if (!IsNumericValue(value))
+		return StaticType::Dynamic;
+	return IsIntegerText(any_cast<const string&>(value)) ? StaticType::Int : StaticType::Float;
+}
+
+// Whole numbers evaluate() computes exactly, in float
+bool IsExactInFloat(int value)
+{
+	return value >= -(1 << 24) && value <= (1 << 24);
+}
+
+// Recursive descent parser with the precedence and quirks of evaluate().
+// Anything evaluate() or EvalExpression would read differently from plain
+// arithmetic (calls, members, '^', unary minus on a name or after ')') is
+// rejected, so those expressions keep running as text
+class TypedExpressionParser
+{
+public:
+	TypedExpressionParser(const string& text, const unordered_map<string, StaticType>& names) : text(replace(text, " ", "")), names(names) {}
+
+	unique_ptr<TypedNode> parse()
+	{
+		unique_ptr<TypedNode> node = parseSum();
+		if (!node || pos != text.size())
+			return nullptr;
+		return node;
+	}
+
+private:
+	string text;
+	const unordered_map<string, StaticType>& names;
+	size_t pos = 0;
+
+	static unique_ptr<TypedNode> toFloat(unique_ptr<TypedNode> node)
+	{
+		if (node->type == StaticType::Float)
+			return node;
+		if (node->op == 'c')
+		{
+			node->type = StaticType::Float;
+			node->floatValue = (float)node->intValue;
+			return node;
+		}
+		unique_ptr<TypedNode> cast(new TypedNode());
+		cast->op = '~';
+		cast->type = StaticType::Float;
+		cast->left = move(node);
+		return cast;
+	}
+
+	static unique_ptr<TypedNode> combine(char op, unique_ptr<TypedNode> left, unique_ptr<TypedNode> right)
+	{
+		unique_ptr<TypedNode> node(new TypedNode());
+		node->op = op;
+		node->type = op != '/' && left->type == StaticType::Int && right->type == StaticType::Int ? StaticType::Int : StaticType::Float;
+		if (node->type == StaticType::Float)
+		{
+			left = toFloat(move(left));
+			right = toFloat(move(right));
+		}
+		node->left = move(left);
+		node->right = move(right);
+		return node;
+	}
+
+	unique_ptr<TypedNode> parseSum()
+	{
+		unique_ptr<TypedNode> left = parseProduct();
+		while (left && pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+		{
+			char op = text[pos++];
+			unique_ptr<TypedNode> right = parseProduct();
+			if (!right)
+				return nullptr;
+			left = combine(op, move(left), move(right));
+		}
+		return left;
+	}
+
+	unique_ptr<TypedNode> parseProduct()
+	{
+		unique_ptr<TypedNode> left = parseOperand();
+		while (left && pos < text.size() && (text[pos] == '*' || text[pos] == '/'))
+		{
+			char op = text[pos++];
+			unique_ptr<TypedNode> right = parseOperand();
+			if (!right)
+				return nullptr;
+			left = combine(op, move(left), move(right));
+		}
+		return left;
+	}
+
+	unique_ptr<TypedNode> parseOperand()
+	{
+		if (pos >= text.size())
+			return nullptr;
+
+		unique_ptr<TypedNode> node;
+		if (text[pos] == '(')
+		{
+			pos++;
+			node = parseSum();
+			if (!node || pos >= text.size() || text[pos] != ')')
+				return nullptr;
+			pos++;
+		}
+		else if (text[pos] == '-' || isdigit(text[pos]))
+			node = parseNumber();
+		else if (startsWith(text.substr(pos), "#const"))
+			node = parseConstant();
+		else if (isalpha(text[pos]) || text[pos] == '_')
+			node = parseName();
+
+		// A '-' right after ')' is read as a sign by evaluate()
+		if (node && pos < text.size() && text[pos - 1] == ')' && text[pos] == '-')
+			return nullptr;
+		return node;
+	}
+
+	unique_ptr<TypedNode> parseNumber()
+	{
+		size_t start = pos;
+		if (text[pos] == '-')
+			pos++;
+		while (pos < text.size() && (isdigit(text[pos]) || text[pos] == '.'))
+			pos++;
+		string number = text.substr(start, pos - start);
+		if (number == "-" || number.back() == '.' || count(number, '.') > 1 || number == "-." || number[number[0] == '-' ? 1 : 0] == '.')
+			return nullptr;
+		if (pos < text.size() && (isalpha(text[pos]) || text[pos] == '_'))
+			return nullptr;
+
+		if (count(number, '.') > 0 || !IsIntegerText(number) || !IsExactInFloat(stoi(number)))
+			return nullptr;
+		unique_ptr<TypedNode> node(new TypedNode());
+		node->op = 'c';
+		node->type = StaticType::Int;
+		node->intValue = stoi(number);
+		return node;
+	}
+
+	unique_ptr<TypedNode> parseConstant()
+	{
+		size_t start = pos += 6;
+		while (pos < text.size() && isdigit(text[pos]))
+			pos++;
+		if (pos == start)
+			return nullptr;
+		const boost::any& value = foldedConstants.at(stoi(text.substr(start, pos - start)));
+		if (StaticTypeOfValue(value) != StaticType::Int || !IsExactInFloat(AnyAsInt(value)))
+			return nullptr;
+
+		unique_ptr<TypedNode> node(new TypedNode());
+		node->op = 'c';
+		node->type = StaticType::Int;
+		node->intValue = AnyAsInt(value);
+		return node;
+	}
+
+	unique_ptr<TypedNode> parseName()
+	{
+		size_t start = pos;
+		while (pos < text.size() && (isalpha(text[pos]) || text[pos] == '_'))
+			pos++;
+		// Members, calls and names EvalExpression would split at a digit
+		if (pos < text.size() && (isdigit(text[pos]) || text[pos] == '.' || text[pos] == '('))
+			return nullptr;
+		auto known = names.find(text.substr(start, pos - start));
+		if (known == names.end() || known->second != StaticType::Int)
+			return nullptr;
+
+		unique_ptr<TypedNode> node(new TypedNode());
+		node->op = 'v';
+		node->type = known->second;
+		node->name = known->first;
+		return node;
+	}
+};
+
+// Type of an expression, or Dynamic if it isn't plain typed arithmetic
+StaticType StaticTypeOfExpression(const string& expression, const unordered_map<string, StaticType>& names)
+{
+	unique_ptr<TypedNode> root = TypedExpressionParser(expression, names).parse();
+	return root ? root->type : StaticType::Dynamic;
+}
+
+bool ReadIntVariable(const string& name, const unordered_map<string, boost::any>& variableValues, int& out)
+{
+	auto found = variableValues.find(name);
+	if (found == variableValues.end())
+		return false;
+	const boost::any& value = found->second;
+	if (value.type() == typeid(int))
+	{
+		out = any_cast<int>(value);
+		return true;
+	}
+	// Number literals are stored as their text
+	if (value.type() == typeid(string) && IsIntegerText(any_cast<const string&>(value)))
+	{
+		out = stoi(any_cast<const string&>(value));
+		return true;
+	}
+	return false;
+}
+
+bool ReadFloatVariable(const string& name, const unordered_map<string, boost::any>& variableValues, float& out)
+{
+	auto found = variableValues.find(name);
+	if (found == variableValues.end() || !IsNumericValue(found->second))
+		return false;
+	out = AnyAsFloat(found->second);
+	return true;
+}
+
+bool EvaluateIntNode(const TypedNode& node, const unordered_map<string, boost::any>& variableValues, int& out)
+{
+	int a, b;
+	switch (node.op)
+	{
+	case 'c':
+		out = node.intValue;
+		return true;
+	case 'v':
+		return ReadIntVariable(node.name, variableValues, out) && IsExactInFloat(out);
+	}
+	if (!EvaluateIntNode(*node.left, variableValues, a) || !EvaluateIntNode(*node.right, variableValues, b))
+		return false;
+	// Operands are within 2^24, so only the product can overflow
+	long long result;
+	if (node.op == '+')
+		result = (long long)a + b;
+	else if (node.op == '-')
+		result = (long long)a - b;
+	else
+		result = (long long)a * b;
+	if (result < -(1 << 24) || result > (1 << 24))
+		return false;
+	out = (int)result;
+	return true;
+}
+
+bool EvaluateFloatNode(const TypedNode& node, const unordered_map<string, boost::any>& variableValues, float& out)
+{
+	float a, b;
+	switch (node.op)
+	{
+	case 'c':
+		out = node.floatValue;
+		return true;
+	case 'v':
+		return ReadFloatVariable(node.name, variableValues, out);
+	case '~':
+	{
+		int i;
+		if (!EvaluateIntNode(*node.left, variableValues, i))
+			return false;
+		out = (float)i;
+		return true;
+	}
+	}
+	if (!EvaluateFloatNode(*node.left, variableValues, a) || !EvaluateFloatNode(*node.right, variableValues, b))
+		return false;
+	switch (node.op)
+	{
+	case '+': out = a + b; break;
+	case '-': out = a - b; break;
+	case '*': out = a * b; break;
+	default: out = a / b; break;
+	}
+	return true;
+}
+
+boost::any EvaluateTypedExpression(size_t index, unordered_map<string, boost::any>& variableValues)
+{
+	const TypedExpression& expression = typedExpressions.at(index);
+	boost::any result;
+	if (expression.root && expression.root->type == StaticType::Int)
+	{
+		int i;
+		if (EvaluateIntNode(*expression.root, variableValues, i))
+			result = i;
+	}
+	else if (expression.root)
+	{
+		float f;
+		if (EvaluateFloatNode(*expression.root, variableValues, f))
+			result = f;
+	}
+	if (result.empty())
+		result = EvalExpression(expression.text, variableValues);
+	// evaluate() always gives a float
+	else if (result.type() == typeid(int))
+		result = (float)any_cast<int>(result);
+
+	return expression.converts ? ToDeclaredType(expression.storeType, result) : result;
+}
+
+// Expands "#typed<index>" words back to their text, for the loop JIT, which
+// reads plain expressions and computes with floats. Words whose result is
+// converted to int are kept, so the JIT rejects those lines
+vector<string> ExpandTypedWords(const vector<string>& line)
+{
+	vector<string> expanded;
+	for (const string& word : line)
+	{
+		if (!startsWith(word, "#typed"))
+		{
+			expanded.push_back(word);
+			continue;
+		}
+		const TypedExpression& expression = typedExpressions.at(stoi(word.substr(6)));
+		if (expression.converts && expression.storeType == StaticType::Int)
+			expanded.push_back(word);
+		else
+			for (const string& part : split(expression.text, ' '))
+				expanded.push_back(part);
+	}
+	return expanded;
+}
+
+// Replaces the words of a line from index start on with a typed expression.
+// Returns false, leaving the line as is, if there is nothing to gain
+bool RewriteTypedTail(vector<string>& line, int start, const unordered_map<string, StaticType>& names, StaticType storeType, bool converts)
+{
+	if ((int)line.size() <= start)
+		return false;
+	string text = unWrapVec(slice(line, start, -1));
+	if (startsWith(text, "#typed"))
+		return false;
+
+	TypedExpression expression;
+	expression.text = text;
+	expression.storeType = storeType;
+	expression.converts = converts;
+	expression.root = TypedExpressionParser(text, names).parse();
+	// Without a tree, the only work left is converting to the declared type
+	if (!expression.root && !converts)
+		return false;
+	// A lone name or whole number evaluates just as fast as text. Negative
+	// numbers don't, evaluate() reads those as a float
+	if (!converts && (expression.root->op == 'v' || (expression.root->op == 'c' && text[0] != '-')))
+		return false;
+
+	typedExpressions.push_back(move(expression));
+	line.erase(line.begin() + start, line.end());
+	line.push_back("#typed" + to_string(typedExpressions.size() - 1));
+	return true;
+}
+
+// Declared type of every local, or Dynamic when it is declared with a type
+// that isn't a number, declared twice with different types, or shares its
+// name with a parameter
+unordered_map<string, StaticType> CollectLocalTypes(const vector<vector<string>>& lines)
+{
+	unordered_map<string, StaticType> locals;
+	for (const string& param : lines.at(0))
+		locals[param] = StaticType::Dynamic;
+	for (size_t lineNum = 1; lineNum < lines.size(); lineNum++)
+	{
+		const vector<string>& line = lines.at(lineNum);
+		if (line.size() < 2 || countInVector(types, line.at(0)) == 0)
+			continue;
+		StaticType type = StaticTypeOf(line.at(0));
+		auto existing = locals.find(line.at(1));
+		if (existing == locals.end())
+			locals[line.at(1)] = type;
+		else if (existing->second != type)
+			existing->second = StaticType::Dynamic;
+	}
+	for (const string& param : lines.at(0))
+		locals.erase(param);
+	return locals;
+}
+
+// Finds "function(arguments)" in an expression and reports the arguments of
+// every call to a script function
+void ForEachCall(const string& expression, const unordered_map<string, vector<vector<string>>>& functions,
+	const function<void(const string&, const vector<string>&)>& onCall)
+{
+	for (size_t i = 0; i < expression.size(); i++)
+	{
+		if (!(isalpha(expression[i]) || expression[i] == '_') || (i > 0 && (isalnum(expression[i - 1]) || expression[i - 1] == '_' || expression[i - 1] == '.')))
+			continue;
+		size_t end = i;
+		while (end < expression.size() && (isalnum(expression[end]) || expression[end] == '_'))
+			end++;
+		if (end >= expression.size() || expression[end] != '(' || functions.count(expression.substr(i, end - i)) == 0)
+			continue;
+
+		int depth = 0;
+		size_t close = end;
+		for (; close < expression.size(); close++)
+		{
+			depth += expression[close] == '(' ? 1 : expression[close] == ')' ? -1 : 0;
+			if (depth == 0)
+				break;
+		}
+		if (close >= expression.size())
+			return;
+		string inside = expression.substr(end + 1, close - end - 1);
+		vector<string> args;
+		if (!trim(inside).empty())
+			for (const string& arg : splitNoOverlap(inside, ',', '(', ')'))
+				args.push_back(trim(arg));
+		onCall(expression.substr(i, end - i), args);
+	}
+}
+
+StaticType JoinTypes(StaticType a, StaticType b)
+{
+	if (a == StaticType::Dynamic || b == StaticType::Dynamic)
+		return StaticType::Dynamic;
+	return a == StaticType::Float || b == StaticType::Float ? StaticType::Float : StaticType::Int;
+}
+
+// Gives a parameter the type of what its calls pass it: int if every call
+// passes an int, float if they pass numbers, Dynamic if any passes something
+// else or there are no calls at all. Starts out assuming int, and widens
+// while parameters that are passed on to other calls (or to recursive ones)
+// widen
+unordered_map<string, unordered_map<string, StaticType>> InferParameterTypes(const unordered_map<string, vector<vector<string>>>& functions,
+	const unordered_map<string, unordered_map<string, StaticType>>& locals)
+{
+	unordered_map<string, unordered_map<string, StaticType>> params;
+	for (const auto& function : functions)
+		for (size_t lineNum = 1; lineNum < function.second.size(); lineNum++)
+			ForEachCall(unWrapVec(function.second.at(lineNum)), functions, [&](const string& callee, const vector<string>&)
+			{
+				for (const string& param : functions.at(callee).at(0))
+					params[callee][param] = StaticType::Int;
+			});
+
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (const auto& function : functions)
+		{
+			unordered_map<string, StaticType> names = locals.at(function.first);
+			auto own = params.find(function.first);
+			if (own != params.end())
+				for (const auto& param : own->second)
+					names[param.first] = param.second;
+
+			for (size_t lineNum = 1; lineNum < function.second.size(); lineNum++)
+				ForEachCall(unWrapVec(function.second.at(lineNum)), functions, [&](const string& callee, const vector<string>& args)
+				{
+					const vector<string>& calleeParams = functions.at(callee).at(0);
+					for (size_t i = 0; i < calleeParams.size(); i++)
+					{
+						StaticType& type = params[callee][calleeParams[i]];
+						StaticType widened = JoinTypes(type, i < args.size() ? StaticTypeOfExpression(args[i], names) : StaticType::Dynamic);
+						if (widened != type)
+						{
+							type = widened;
+							changed = true;
+						}
+					}
+				});
+		}
+	}
+	return params;
+}
+
+void TypeLines(vector<vector<string>>& lines, const unordered_map<string, StaticType>& names, const unordered_map<string, StaticType>& locals)
+{
+	for (size_t lineNum = 1; lineNum < lines.size(); lineNum++)
+	{
+		vector<string>& line = lines.at(lineNum);
+		const string& first = line.at(0);
+
+		if (countInVector(types, first) > 0 && line.size() >= 4 && line.at(2) == "=")
+		{
+			auto local = locals.find(line.at(1));
+			if (local == locals.end() || local->second == StaticType::Dynamic)
+				continue;
+			if (line.at(3)[0] == '\"')
+				LogWarning("'" + first + " " + line.at(1) + "' is assigned a string");
+			else
+				RewriteTypedTail(line, 3, names, local->second, true);
+		}
+		// Only declarations convert, a local keeps whatever it is assigned later
+		else if (line.size() >= 3 && line.at(1) == "=" && names.count(first) > 0 && names.at(first) != StaticType::Dynamic)
+			RewriteTypedTail(line, 2, names, StaticType::Dynamic, false);
+		// "+=" on a string is evaluated as one expression with the target, so
+		// its right side stays text
+		else if (line.size() >= 3 && (line.at(1) == "-=" || line.at(1) == "*=" || line.at(1) == "/=") && names.count(first) > 0
+			&& names.at(first) != StaticType::Dynamic)
+			RewriteTypedTail(line, 2, names, StaticType::Dynamic, false);
+		else if (toLower(first) == "return")
+			RewriteTypedTail(line, 1, names, StaticType::Dynamic, false);
+		else if ((toLower(first) == "if" || toLower(first) == "while") && line.size() == 4 && count(unWrapVec(line), '{') == 0
+			&& line.at(2) != "&&" && line.at(2) != "||")
+		{
+			// Sides are single words, rewrite them from the back
+			RewriteTypedTail(line, 3, names, StaticType::Dynamic, false);
+			vector<string> left(line.begin(), line.begin() + 2);
+			if (RewriteTypedTail(left, 1, names, StaticType::Dynamic, false))
+				line.at(1) = left.at(1);
+		}
+	}
+}
+
+// Parameter types inferred from every call site, at --opt-level 2 only
+unordered_map<string, unordered_map<string, StaticType>> inferredParameters;
+
+// Run once all modules are parsed, before any function is optimized
+void TypeProgram(const unordered_map<string, vector<vector<string>>>& functions, int level)
+{
+	inferredParameters.clear();
+	if (level < 2)
+		return;
+	unordered_map<string, unordered_map<string, StaticType>> locals;
+	for (const auto& function : functions)
+		locals[function.first] = CollectLocalTypes(function.second);
+	inferredParameters = InferParameterTypes(functions, locals);
+}
+
+// Types a function right after OptimizeFunction optimized it
+void TypeFunction(const string& name, vector<vector<string>>& lines)
+{
+	unordered_map<string, StaticType> locals = CollectLocalTypes(lines);
+	unordered_map<string, StaticType> names = locals;
+	auto params = inferredParameters.find(name);
+	if (params != inferredParameters.end())
+		for (const auto& param : params->second)
+		{
+			names[param.first] = param.second;
+#if DEVELOPER_MESSAGES == true
+			if (param.second != StaticType::Dynamic)
+				InterpreterLog("Inferred " + string(param.second == StaticType::Int ? "int " : "float ") + name + "(" + param.first + ")");
+#endif
+		}
+	TypeLines(lines, names, locals);
+}
+
+#endif
@@ -0,0 +1,261 @@
+// vec_buffer.cpp - Packed 2D vector buffers and their SIMD kernels
+
+#include "vec_buffer.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define VEC_SSE 1
+// AVX kernels are compiled for AVX on their own and only run when the CPU
+// has it, so the rest of the interpreter stays runnable on any x86-64
+#if defined(__GNUC__) || defined(__clang__)
+#define VEC_AVX 1
+#define AVX_KERNEL __attribute__((target("avx")))
+#endif
+#endif
+
+using namespace std;
+
+namespace VecBuffer {
+	struct Buffer {
+		vector<float> x;
+		vector<float> y;
+	};
+
+	static unordered_map<int, Buffer> buffers;
+	static int nextHandle = 1;
+
+	static Buffer* find(int handle) {
+		auto it = buffers.find(handle);
+		return it == buffers.end() ? nullptr : &it->second;
+	}
+
+	// Scalar kernels, also used for the elements left over after the last
+	// full SIMD register
+	static void addScaledScalar(float* target, const float* source, float scale, size_t start, size_t count) {
+		for (size_t i = start; i < count; i++)
+			target[i] += source[i] * scale;
+	}
+
+	static void normalizeScalar(float* x, float* y, size_t start, size_t count) {
+		for (size_t i = start; i < count; i++) {
+			float length = sqrtf(x[i] * x[i] + y[i] * y[i]);
+			if (length > 0) {
+				x[i] /= length;
+				y[i] /= length;
+			}
+		}
+	}
+
+	// Written as maxps then minps compute, which return their second operand
+	// when either is NaN, so every kernel turns a NaN value into low.
+	// std::max and std::min would keep it instead
+	static void clampScalar(float* values, float low, float high, size_t start, size_t count) {
+		for (size_t i = start; i < count; i++) {
+			float raised = values[i] > low ? values[i] : low;
+			values[i] = raised < high ? raised : high;
+		}
+	}
+
+#ifdef VEC_SSE
+	static void addScaledSse(float* target, const float* source, float scale, size_t count) {
+		__m128 s = _mm_set1_ps(scale);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(_mm_loadu_ps(source + i), s)));
+		addScaledScalar(target, source, scale, i, count);
+	}
+
+	static void normalizeSse(float* x, float* y, size_t count) {
+		__m128 zero = _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i);
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+			// Lanes of zero length keep their value
+			__m128 nonZero = _mm_cmpgt_ps(length, zero);
+			__m128 nx = _mm_div_ps(vx, length), ny = _mm_div_ps(vy, length);
+			_mm_storeu_ps(x + i, _mm_or_ps(_mm_and_ps(nonZero, nx), _mm_andnot_ps(nonZero, vx)));
+			_mm_storeu_ps(y + i, _mm_or_ps(_mm_and_ps(nonZero, ny), _mm_andnot_ps(nonZero, vy)));
+		}
+		normalizeScalar(x, y, i, count);
+	}
+
+	static void clampSse(float* values, float low, float high, size_t count) {
+		__m128 lo = _mm_set1_ps(low), hi = _mm_set1_ps(high);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+			_mm_storeu_ps(values + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + i), lo), hi));
+		clampScalar(values, low, high, i, count);
+	}
+#endif
+
+#ifdef VEC_AVX
+	AVX_KERNEL static void addScaledAvx(float* target, const float* source, float scale, size_t count) {
+		__m256 s = _mm256_set1_ps(scale);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(target + i, _mm256_add_ps(_mm256_loadu_ps(target + i), _mm256_mul_ps(_mm256_loadu_ps(source + i), s)));
+		addScaledScalar(target, source, scale, i, count);
+	}
+
+	AVX_KERNEL static void normalizeAvx(float* x, float* y, size_t count) {
+		__m256 zero = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i);
+			__m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)));
+			__m256 nonZero = _mm256_cmp_ps(length, zero, _CMP_GT_OQ);
+			_mm256_storeu_ps(x + i, _mm256_blendv_ps(vx, _mm256_div_ps(vx, length), nonZero));
+			_mm256_storeu_ps(y + i, _mm256_blendv_ps(vy, _mm256_div_ps(vy, length), nonZero));
+		}
+		normalizeScalar(x, y, i, count);
+	}
+
+	AVX_KERNEL static void clampAvx(float* values, float low, float high, size_t count) {
+		__m256 lo = _mm256_set1_ps(low), hi = _mm256_set1_ps(high);
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(values + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + i), lo), hi));
+		clampScalar(values, low, high, i, count);
+	}
+
+	static bool hasAvx() {
+		static bool supported = __builtin_cpu_supports("avx");
+		return supported;
+	}
+#endif
+
+	static void addScaledKernel(float* target, const float* source, float scale, size_t count) {
+#ifdef VEC_AVX
+		if (hasAvx())
+			return addScaledAvx(target, source, scale, count);
+#endif
+#ifdef VEC_SSE
+		addScaledSse(target, source, scale, count);
+#else
+		addScaledScalar(target, source, scale, 0, count);
+#endif
+	}
+
+	static void normalizeKernel(float* x, float* y, size_t count) {
+#ifdef VEC_AVX
+		if (hasAvx())
+			return normalizeAvx(x, y, count);
+#endif
+#ifdef VEC_SSE
+		normalizeSse(x, y, count);
+#else
+		normalizeScalar(x, y, 0, count);
+#endif
+	}
+
+	static void clampKernel(float* values, float low, float high, size_t count) {
+#ifdef VEC_AVX
+		if (hasAvx())
+			return clampAvx(values, low, high, count);
+#endif
+#ifdef VEC_SSE
+		clampSse(values, low, high, count);
+#else
+		clampScalar(values, low, high, 0, count);
+#endif
+	}
+
+	const char* instructionSet() {
+#ifdef VEC_AVX
+		if (hasAvx())
+			return "avx";
+#endif
+#ifdef VEC_SSE
+		return "sse";
+#else
+		return "scalar";
+#endif
+	}
+
+	int create(size_t count, float x, float y) {
+		int handle = nextHandle++;
+		Buffer& buffer = buffers[handle];
+		buffer.x.assign(count, x);
+		buffer.y.assign(count, y);
+		return handle;
+	}
+
+	bool release(int handle) {
+		return buffers.erase(handle) > 0;
+	}
+
+	bool isValid(int handle) {
+		return find(handle) != nullptr;
+	}
+
+	size_t size(int handle) {
+		Buffer* buffer = find(handle);
+		return buffer == nullptr ? 0 : buffer->x.size();
+	}
+
+	bool set(int handle, size_t index, float x, float y) {
+		Buffer* buffer = find(handle);
+		if (buffer == nullptr || index >= buffer->x.size())
+			return false;
+		buffer->x[index] = x;
+		buffer->y[index] = y;
+		return true;
+	}
+
+	float getX(int handle, size_t index) {
+		Buffer* buffer = find(handle);
+		return buffer == nullptr || index >= buffer->x.size() ? 0.0f : buffer->x[index];
+	}
+
+	float getY(int handle, size_t index) {
+		Buffer* buffer = find(handle);
+		return buffer == nullptr || index >= buffer->y.size() ? 0.0f : buffer->y[index];
+	}
+
+	bool fill(int handle, float x, float y) {
+		Buffer* buffer = find(handle);
+		if (buffer == nullptr)
+			return false;
+		std::fill(buffer->x.begin(), buffer->x.end(), x);
+		std::fill(buffer->y.begin(), buffer->y.end(), y);
+		return true;
+	}
+
+	bool addScaled(int target, int source, float scale) {
+		Buffer* t = find(target);
+		Buffer* s = find(source);
+		if (t == nullptr || s == nullptr)
+			return false;
+		size_t count = min(t->x.size(), s->x.size());
+		addScaledKernel(t->x.data(), s->x.data(), scale, count);
+		addScaledKernel(t->y.data(), s->y.data(), scale, count);
+		return true;
+	}
+
+	float length(int handle, size_t index) {
+		float x = getX(handle, index), y = getY(handle, index);
+		return sqrtf(x * x + y * y);
+	}
+
+	bool normalize(int handle) {
+		Buffer* buffer = find(handle);
+		if (buffer == nullptr)
+			return false;
+		normalizeKernel(buffer->x.data(), buffer->y.data(), buffer->x.size());
+		return true;
+	}
+
+	bool clamp(int handle, float minX, float minY, float maxX, float maxY) {
+		Buffer* buffer = find(handle);
+		if (buffer == nullptr)
+			return false;
+		clampKernel(buffer->x.data(), minX, maxX, buffer->x.size());
+		clampKernel(buffer->y.data(), minY, maxY, buffer->y.size());
+		return true;
+	}
+}
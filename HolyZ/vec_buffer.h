@@ -0,0 +1,33 @@
+#ifndef VEC_BUFFER_H
+#define VEC_BUFFER_H
+
+#include <cstddef>
+
+// Buffers of 2D vectors for ZS.Vec, stored as one array of x and one of y so
+// whole buffers can be updated with SIMD (AVX or SSE where the CPU has them,
+// plain loops otherwise). Scripts refer to a buffer by the int handle create
+// returns, like file streams
+namespace VecBuffer {
+	int create(size_t count, float x, float y);
+	bool release(int handle);
+	bool isValid(int handle);
+	size_t size(int handle);
+
+	bool set(int handle, size_t index, float x, float y);
+	float getX(int handle, size_t index);
+	float getY(int handle, size_t index);
+	bool fill(int handle, float x, float y);
+
+	// target[i] += source[i] * scale, over the shorter of the two buffers
+	bool addScaled(int target, int source, float scale);
+	float length(int handle, size_t index);
+	// Scales every vector to length 1, leaving zero vectors as they are
+	bool normalize(int handle);
+	// Keeps every vector inside the box from min to max
+	bool clamp(int handle, float minX, float minY, float maxX, float maxY);
+
+	// Name of the kernels in use, "avx", "sse" or "scalar"
+	const char* instructionSet();
+}
+
+#endif
@@ -0,0 +1,36 @@
+// Example native extension module
+// Build: c++ -std=c++17 -O2 -shared -fPIC -I../../HolyZ hash_module.cpp -o hash_module.so
+
+#include "holyz_module.h"
+#include <cstdint>
+
+// 32-bit FNV-1a hash of a string
+static HolyZValue Fnv1a(const HolyZValue* args, size_t)
+{
+	if (args[0].type != HOLYZ_STRING)
+		return holyz_null();
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < args[0].as.s.length; i++)
+	{
+		hash ^= (unsigned char)args[0].as.s.data[i];
+		hash *= 16777619u;
+	}
+	return holyz_int((int)(hash & 0x7fffffff));
+}
+
+// Sum of any number of values
+static HolyZValue Sum(const HolyZValue* args, size_t argCount)
+{
+	double total = 0;
+	for (size_t i = 0; i < argCount; i++)
+		total += holyz_to_double(&args[i]);
+	return holyz_float((float)total);
+}
+
+HOLYZ_MODULE_EXPORT int holyz_module_init(HolyZRegistry* registry)
+{
+	if (registry->abiVersion != HOLYZ_MODULE_ABI_VERSION)
+		return 0;
+	return registry->registerFunction(registry, "Hash.Fnv1a", Fnv1a, 1)
+		&& registry->registerFunction(registry, "Hash.Sum", Sum, -1);
+}